@@ -1,4 +1,8 @@
 #include "Base.hpp"
+#include <algorithm>
+#include <cassert>
+#include <cstdint>
+#include <new>
 
 using namespace std;
 
@@ -9,33 +13,239 @@ void Edge::SetPriv(void * priv) {
     }
 }
 
+#define ARENA_BLOCK_SIZE (1 << 20)
+
+static size_t AlignPad(const char * p, size_t align) {
+    return (align - (uintptr_t)p % align) % align;
+}
+
+void * Arena::Allocate(size_t size, size_t align) {
+    if (size > ARENA_BLOCK_SIZE / 4) {
+        // large requests get their own block and keep the current one
+        char * b = new char[size + align];
+        _blocks.push_back(b);
+        _bytes += size + align;
+        return b + AlignPad(b, align);
+    }
+
+    size_t pad = _cur == nullptr ? 0 : AlignPad(_cur, align);
+    if (_cur == nullptr || pad + size > _left) {
+        _cur = new char[ARENA_BLOCK_SIZE];
+        _blocks.push_back(_cur);
+        _left = ARENA_BLOCK_SIZE;
+        _bytes += ARENA_BLOCK_SIZE;
+        pad = AlignPad(_cur, align);
+    }
+
+    void * r = _cur + pad;
+    _cur += pad + size;
+    _left -= pad + size;
+    return r;
+}
+
+Arena::~Arena() {
+    for (auto b : _blocks) { delete [] b; }
+}
+
+CsrGraph::CsrGraph(const Graph & g)
+    : vertices(g.vertices) {
+    int n = vertices.size();
+    succStart.resize(n + 1, 0);
+    depStart.resize(n + 1, 0);
+    predCount.resize(n, 0);
+
+    for (auto v : vertices) {
+        for (auto e : v->outEdges) {
+            if (e->IsDirected()) {
+                ++succStart[v->id + 1];
+                ++predCount[e->to->id];
+            }
+            else {
+                ++depStart[v->id + 1];
+            }
+        }
+    }
+
+    for (int i = 0; i < n; ++i) {
+        succStart[i + 1] += succStart[i];
+        depStart[i + 1] += depStart[i];
+    }
+
+    succ.resize(succStart[n]);
+    dep.resize(depStart[n]);
+
+    for (auto v : vertices) {
+        int s = succStart[v->id];
+        int d = depStart[v->id];
+        for (auto e : v->outEdges) {
+            if (e->IsDirected()) {
+                succ[s++] = e->to->id;
+            }
+            else {
+                dep[d++] = e->to->id;
+            }
+        }
+    }
+
+    initial.inDegree = predCount;
+    for (int i = 0; i < n; ++i) {
+        if (predCount[i] == 0) {
+            initial.frontier.push_back(i);
+        }
+    }
+}
+
+TopoWalk::TopoWalk(const CsrGraph & g)
+    : _graph(&g) {
+    // no reallocation during walks
+    _state.frontier.reserve(g.Size());
+    _enabled.reserve(g.Size());
+    Reset();
+}
+
+void TopoWalk::Reset(bool trackFrontier) {
+    _state = _graph->initial;
+    _enabled.clear();
+    _remaining = _graph->Size();
+    _trackFrontier = trackFrontier;
+}
+
+void TopoWalk::Schedule(int v) {
+    assert(InFrontier(v));
+    auto & frontier = _state.frontier;
+    if (_trackFrontier) {
+        frontier.erase(lower_bound(frontier.begin(), frontier.end(), v));
+    }
+    _state.inDegree[v] = -1;
+    --_remaining;
+
+    _enabled.clear();
+    for (auto s = _graph->SuccBegin(v); s != _graph->SuccEnd(v); ++s) {
+        if (--_state.inDegree[*s] == 0) {
+            if (_trackFrontier) {
+                frontier.insert(lower_bound(frontier.begin(), frontier.end(), *s), *s);
+            }
+            _enabled.push_back(*s);
+        }
+    }
+}
+
+void TopoWalk::Unschedule(int v) {
+    assert(_state.inDegree[v] == -1);
+    auto & frontier = _state.frontier;
+    for (auto s = _graph->SuccBegin(v); s != _graph->SuccEnd(v); ++s) {
+        if (_state.inDegree[*s]++ == 0 && _trackFrontier) {
+            frontier.erase(lower_bound(frontier.begin(), frontier.end(), *s));
+        }
+    }
+    _state.inDegree[v] = 0;
+    ++_remaining;
+    if (_trackFrontier) {
+        frontier.insert(lower_bound(frontier.begin(), frontier.end(), v), v);
+    }
+    _enabled.clear();
+}
+
 Vertex * Graph::NewVertex() {
+    assert(_frozen == nullptr);
     Vertex * r = new Vertex();
     r->id = vertices.size();
     vertices.push_back(r);
     return r;
 }
 
-Edge * Graph::AddEdge(Vertex * from, Vertex * to, bool directed) {
-    Edge * e = new Edge();
+Edge * Graph::NewEdges(size_t count) {
+    Edge * e = static_cast<Edge *>(_edgePool.Allocate(count * sizeof(Edge), alignof(Edge)));
+    for (size_t i = 0; i < count; ++i) {
+        new (e + i) Edge();
+    }
+    return e;
+}
+
+void Graph::LinkEdge(Edge * e, Vertex * from, Vertex * to) {
     e->from = from;
     e->to = to;
     from->outEdges.push_back(e);
     to->inEdges.push_back(e);
     edges.push_back(e);
+}
+
+Edge * Graph::AddEdge(Vertex * from, Vertex * to, bool directed) {
+    assert(_frozen == nullptr);
+    Edge * e = NewEdges(directed ? 1 : 2);
+    LinkEdge(e, from, to);
 
     if (directed) {
         e->dualEdge = nullptr;
     }
     else {
-        e->dualEdge = AddEdge(to, from, true);
-        e->dualEdge->dualEdge = e;
+        LinkEdge(e + 1, to, from);
+        e->dualEdge = e + 1;
+        e[1].dualEdge = e;
     }
 
     return e;
 }
 
+// Grows v to hold n elements, at least doubling its capacity so that a graph
+// built by many AddEdges calls still copies every list O(1) times amortized
+static void Reserve(vector<Edge *> & v, size_t n) {
+    if (v.capacity() < n) {
+        v.reserve(max(n, 2 * v.capacity()));
+    }
+}
+
+void Graph::AddEdges(const vector<pair<int, int>> & pairs, bool directed) {
+    assert(_frozen == nullptr);
+    if (pairs.empty()) return;
+
+    // final degrees, so that every list grows at most once per call
+    vector<int> outDegree(vertices.size()), inDegree(vertices.size());
+    for (int i = 0; i < vertices.size(); ++i) {
+        outDegree[i] = vertices[i]->outEdges.size();
+        inDegree[i] = vertices[i]->inEdges.size();
+    }
+    for (auto && p : pairs) {
+        ++outDegree[p.first];
+        ++inDegree[p.second];
+        if (!directed) {
+            ++outDegree[p.second];
+            ++inDegree[p.first];
+        }
+    }
+    for (int i = 0; i < vertices.size(); ++i) {
+        Reserve(vertices[i]->outEdges, outDegree[i]);
+        Reserve(vertices[i]->inEdges, inDegree[i]);
+    }
+
+    int k = directed ? 1 : 2;
+    size_t count = pairs.size() * k;
+    Reserve(edges, edges.size() + count);
+    Edge * e = NewEdges(count);
+    for (auto && p : pairs) {
+        Vertex * from = vertices[p.first];
+        Vertex * to = vertices[p.second];
+        LinkEdge(e, from, to);
+        if (directed) {
+            e->dualEdge = nullptr;
+        }
+        else {
+            LinkEdge(e + 1, to, from);
+            e->dualEdge = e + 1;
+            e[1].dualEdge = e;
+        }
+        e += k;
+    }
+}
+
+const CsrGraph & Graph::Freeze() {
+    if (_frozen == nullptr) {
+        _frozen = new CsrGraph(*this);
+    }
+    return *_frozen;
+}
+
 Graph::~Graph() {
+    delete _frozen;
     for (auto v : vertices) { delete v; }
-    for (auto e : edges) { delete e; }
 }
@@ -1,15 +1,57 @@
 #ifndef __BASE_HPP__
 #define __BASE_HPP__
 
+#include <cstddef>
 #include <vector>
 #include <map>
 #include <random>
+#include <utility>
 
 typedef std::mt19937_64 random_engine;
 
 #define DBG(COND, BODY) do { if (COND) { BODY; } } while(0)
 
 struct Vertex;
+struct Graph;
+
+// Bump allocator that releases all of its blocks at once. Deallocation is a
+// no-op and destructors of objects placed in it need not run, so such
+// objects must not own memory outside the arena.
+class Arena {
+    std::vector<char *> _blocks;
+    char * _cur;
+    size_t _left;
+    size_t _bytes;
+
+public:
+    Arena() : _cur(nullptr), _left(0), _bytes(0) { }
+    Arena(const Arena &) = delete;
+    Arena & operator=(const Arena &) = delete;
+    ~Arena();
+
+    void * Allocate(size_t size, size_t align);
+    // Bytes reserved so far; the arena never shrinks, so this is also the peak
+    inline size_t Bytes() const { return _bytes; }
+};
+
+// Standard allocator adaptor so that containers can live in an Arena
+template <typename T>
+struct ArenaAllocator {
+    typedef T value_type;
+    Arena * arena;
+
+    explicit ArenaAllocator(Arena * a) : arena(a) { }
+    template <typename U>
+    ArenaAllocator(const ArenaAllocator<U> & o) : arena(o.arena) { }
+
+    inline T * allocate(size_t n) { return static_cast<T *>(arena->Allocate(n * sizeof(T), alignof(T))); }
+    inline void deallocate(T *, size_t) { }
+};
+
+template <typename T, typename U>
+inline bool operator==(const ArenaAllocator<T> & a, const ArenaAllocator<U> & b) { return a.arena == b.arena; }
+template <typename T, typename U>
+inline bool operator!=(const ArenaAllocator<T> & a, const ArenaAllocator<U> & b) { return a.arena != b.arena; }
 
 struct Edge {
     Vertex * from;
@@ -28,17 +70,94 @@ struct Vertex {
     std::vector<Edge *> outEdges;
 };
 
+// State of a topological walk: per-vertex count of unscheduled directed
+// predecessors (-1 once scheduled) and the enabled vertices sorted by id.
+struct TopoState {
+    std::vector<int> inDegree;
+    std::vector<int> frontier;
+};
+
+// Frozen compressed-sparse-row view of a graph, indexed by Vertex::id.
+// Directed successors and undirected dependency neighbours are kept in
+// separate contiguous arrays in the same order as Vertex::outEdges.
+struct CsrGraph {
+    std::vector<Vertex *> vertices;
+    std::vector<int> succStart; // size() + 1 entries
+    std::vector<int> succ;
+    std::vector<int> predCount; // number of directed in-edges
+    std::vector<int> depStart;  // size() + 1 entries
+    std::vector<int> dep;
+    TopoState initial; // state before any vertex is scheduled
+
+    explicit CsrGraph(const Graph & g);
+
+    inline int Size() const { return predCount.size(); }
+    inline const int * SuccBegin(int v) const { return succ.data() + succStart[v]; }
+    inline const int * SuccEnd(int v) const { return succ.data() + succStart[v + 1]; }
+    inline const int * DepBegin(int v) const { return dep.data() + depStart[v]; }
+    inline const int * DepEnd(int v) const { return dep.data() + depStart[v + 1]; }
+};
+
+// Incremental topological walk over a frozen graph. Reset() copies the
+// precomputed initial state into buffers reused across walks.
+class TopoWalk {
+    const CsrGraph * _graph;
+    TopoState _state;
+    std::vector<int> _enabled;
+    int _remaining;
+    bool _trackFrontier;
+
+public:
+    explicit TopoWalk(const CsrGraph & g);
+
+    // Callers that keep their own frontier may skip maintaining the sorted
+    // one; Frontier() then stays at the initial frontier.
+    void Reset(bool trackFrontier = true);
+    inline const CsrGraph & GetGraph() const { return *_graph; }
+    inline const std::vector<int> & Frontier() const { return _state.frontier; }
+    inline bool InFrontier(int v) const { return _state.inDegree[v] == 0; }
+    inline bool Done() const { return _remaining == 0; }
+    // Vertices enabled by the last Schedule(), in successor order
+    inline const std::vector<int> & Enabled() const { return _enabled; }
+
+    // Removes v from the frontier and enables the successors it was the last
+    // directed predecessor of
+    void Schedule(int v);
+    // Reverts Schedule(v); v must be the last vertex scheduled and not yet
+    // unscheduled. Enabled() is cleared.
+    void Unschedule(int v);
+};
+
+// Edges live in a pool owned by the graph, an undirected edge right before
+// its dual.
 struct Graph {
     std::vector<Vertex *> vertices;
     std::vector<Edge *> edges;
 
+    Graph() : _frozen(nullptr) { }
+
     Vertex * NewVertex();
     Edge * AddEdge(Vertex * from, Vertex * to, bool directed);
     // Simple wrappers
-    inline Edge * AddUndirectedEdge(Vertex * from, Vertex * to) { AddEdge(from, to, false); }
-    inline Edge * AddDirectedEdge(Vertex * from, Vertex * to) { AddEdge(from, to, true); }
+    inline Edge * AddUndirectedEdge(Vertex * from, Vertex * to) { return AddEdge(from, to, false); }
+    inline Edge * AddDirectedEdge(Vertex * from, Vertex * to) { return AddEdge(from, to, true); }
+    // Same as calling AddEdge on every (from id, to id) pair in turn, but
+    // with the edges in one block and the adjacency lists grown at most once,
+    // geometrically, so that it can also be called once per batch of edges
+    void AddEdges(const std::vector<std::pair<int, int>> & pairs, bool directed);
+
+    // Builds the CSR view on first call and returns the cached one afterwards.
+    // The graph must not be modified once frozen.
+    const CsrGraph & Freeze();
 
     ~Graph();
+
+private:
+    CsrGraph * _frozen;
+    Arena _edgePool;
+
+    Edge * NewEdges(size_t count);
+    void LinkEdge(Edge * e, Vertex * from, Vertex * to);
 };
 
 #endif
@@ -1,7 +1,14 @@
 #include "Base.hpp"
 #include "Schedulers.hpp"
 #include "PorStat.hpp"
+#include "Counting.hpp"
+#include "TraceStore.hpp"
+#include "CaseIO.hpp"
 #include <cassert>
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
 #include <iostream>
 #include <string>
 #include <regex>
@@ -9,321 +16,220 @@
 #include <set>
 #include <map>
 #include <fstream>
+#include <functional>
+#include <memory>
+#include <thread>
 #include <unistd.h>
 
 #define DBG_CALC 0
 #define PCT_DUMMY_START 1
+// samples between two chances to checkpoint
+#define SAMPLE_BLOCK (1L << 20)
 
 using namespace std;
 
-typedef vector<int> MulFactor;
-struct AddFactor {
-    vector<MulFactor> factors;
+// Probability of reaching one partial order class, accumulated in O(1)
+// space. Exact bounds add one term per total order; sampled columns only
+// count hits and divide by the number of samples at the end.
+struct ProbAcc {
+    long hits;
+    long samples; // 0 for exact bounds
+    double sum;
+
+    ProbAcc() : hits(0), samples(0), sum(0) { }
+
+    inline void Add(double p) { ++hits; sum = sum + p; }
+    inline void AddHits(long n, long total) { hits += n; samples = total; }
+    inline void Merge(const ProbAcc & o) { hits += o.hits; sum = sum + o.sum; }
 };
-map<PorNode *, vector<Vertex *>> trace;
-map<PorNode *, set<tuple<Vertex *, Vertex *>>> races;
-map<PorNode *, AddFactor> rwBound;
-map<PorNode *, AddFactor> bposBound;
-map<PorNode *, AddFactor> posBound;
-map<PorNode *, AddFactor> pctBound;
-map<PorNode *, AddFactor> raposSample;
-map<PorNode *, AddFactor> bposSample;
-map<PorNode *, AddFactor> posSample;
-map<PorNode *, AddFactor> rposSample;
-map<PorNode *, int> preemptionNeeded;
+
+// Per-class statistics as columns indexed by the class number
+TraceStore traces; // first order of every class, by class index
+vector<set<tuple<Vertex *, Vertex *>>> races;
+vector<ProbAcc> rwBound;
+vector<ProbAcc> bposBound;
+vector<ProbAcc> posBound;
+vector<ProbAcc> pctBound;
+vector<ProbAcc> raposSample;
+vector<ProbAcc> bposSample;
+vector<ProbAcc> posSample;
+vector<ProbAcc> rposSample;
+vector<int> preemptionNeeded; // -1 until the class is reached
 map<int, int> preemptionStat;
 
-ostream & operator<<(ostream & o, const AddFactor & f) {
-    o << '[';
-    bool first = true;
-    for (auto && m : f.factors) {
-        if (first) first = false;
-        else o << ',';
-        o << '(';
-        {
-            bool first = true;
-            for (auto && i : m) {
-                if (first) first = false;
-                else o << ',';
-                o << i;
-            }
-        }
-        o << ')';
+// Grows the columns on the first sight of a class and returns its index
+size_t ClassIndex(int cls) {
+    assert(cls >= 0);
+    size_t c = cls;
+    if (c >= rwBound.size()) {
+        races.resize(c + 1);
+        rwBound.resize(c + 1);
+        bposBound.resize(c + 1);
+        posBound.resize(c + 1);
+        pctBound.resize(c + 1);
+        raposSample.resize(c + 1);
+        bposSample.resize(c + 1);
+        posSample.resize(c + 1);
+        rposSample.resize(c + 1);
+        preemptionNeeded.resize(c + 1, -1);
     }
-    o << ']';
+    return c;
 }
 
-double Calc(const AddFactor & f) {
-    double r = 0;
-    for (auto && m : f.factors) {
-        double d = 1;
-        for (auto && i : m) {
-            d = d / i;
-        }
-        r = r + d;
-    }
-    return r;
+double Calc(const ProbAcc & f) {
+    if (f.samples > 0) return (double)f.hits / f.samples;
+    return f.sum;
 }
 
-ostream & operator<<(ostream & o, const set<Vertex *> & s) {
+ostream & operator<<(ostream & o, const set<int> & s) {
     o << '{';
     bool first = true;
     for (auto v : s) {
         if (first) first = false;
         else o << ',';
-        o << v->id;
+        o << v;
     }
     o << '}';
+    return o;
 }
 
-int GetRaces(Graph * g, const vector<Vertex *> & o, set<tuple<Vertex *, Vertex *>> & races) {
-    map<Vertex *, int> inDegree;
-    set<Vertex *> frontier;
-
-    for (auto v : g->vertices) {
-        int d = 0;
-        for (auto e : v->inEdges) {
-            if (e->IsDirected()) {
-                ++d;
-            }
-        }
-
-        inDegree[v] = d;
-        if (d == 0) {
-            frontier.insert(v);
-        }
-    }
+void GetRaces(TopoWalk & walk, const vector<Vertex *> & o, set<tuple<Vertex *, Vertex *>> & races) {
+    const CsrGraph & csr = walk.GetGraph();
+    walk.Reset();
 
     for (int i = 0; i < o.size(); ++i) {
-        assert(frontier.size() > 0);
-        assert(frontier.find(o[i]) != end(frontier));
-
-        auto choice = o[i];
-        for (auto e : choice->outEdges) {
-            if (e->IsDirected()) {
-                if (--inDegree[e->to] == 0) {
-                    frontier.insert(e->to);
-                }
-            }
-            else if (frontier.find(e->to) != end(frontier)) {
-                races.insert(make_tuple(choice, e->to));
+        assert(!walk.Done());
+        int choice = o[i]->id;
+        walk.Schedule(choice);
+
+        for (auto d = csr.DepBegin(choice); d != csr.DepEnd(choice); ++d) {
+            if (walk.InFrontier(*d)) {
+                races.insert(make_tuple(o[i], csr.vertices[*d]));
             }
         }
-
-        frontier.erase(choice);
     }
 
-    assert(frontier.size() == 0);
+    assert(walk.Done());
 }
 
-int GetPreemption(Graph * g, const vector<Vertex *> & o) {
+int GetPreemption(TopoWalk & walk, const vector<Vertex *> & o) {
     int ret = 0;
-    map<Vertex *, int> inDegree;
-    set<Vertex *> frontier;
-    set<Vertex *> freshFrontier;
-
-    for (auto v : g->vertices) {
-        int d = 0;
-        for (auto e : v->inEdges) {
-            if (e->IsDirected()) {
-                ++d;
-            }
-        }
-
-        inDegree[v] = d;
-        if (d == 0) {
-            freshFrontier.insert(v);
-        }
-    }
+    walk.Reset();
+    // vertices enabled by the previous step, initially the whole frontier
+    vector<int> fresh(walk.Frontier());
 
     for (int i = 0; i < o.size(); ++i) {
-        frontier.insert(begin(freshFrontier), end(freshFrontier));
-        assert(frontier.size() > 0);
-        assert(frontier.find(o[i]) != end(frontier));
+        assert(!walk.Done());
+        int choice = o[i]->id;
 
-        if (freshFrontier.find(o[i]) == end(freshFrontier) && freshFrontier.size() > 0) {
+        if (fresh.size() > 0 && find(fresh.begin(), fresh.end(), choice) == fresh.end()) {
             ++ret;
         }
 
-        freshFrontier.clear();
-
-        auto choice = o[i];
-        for (auto e : choice->outEdges) {
-            if (e->IsDirected()) {
-                if (--inDegree[e->to] == 0) {
-                    freshFrontier.insert(e->to);
-                }
-            }
-        }
-
-        frontier.erase(choice);
+        walk.Schedule(choice);
+        fresh = walk.Enabled();
     }
 
-    assert(frontier.size() == 0);
+    assert(walk.Done());
     return ret;
 }
 
-void AccountRWBound(AddFactor & f, Graph * g, const vector<Vertex *> & o) {
-    MulFactor cur;
-    map<Vertex *, int> inDegree;
-    set<Vertex *> frontier;
-
-    for (auto v : g->vertices) {
-        int d = 0;
-        for (auto e : v->inEdges) {
-            if (e->IsDirected()) {
-                ++d;
-            }
-        }
-
-        inDegree[v] = d;
-        if (d == 0) {
-            frontier.insert(v);
-        }
-    }
+void AccountRWBound(ProbAcc & f, TopoWalk & walk, const vector<Vertex *> & o) {
+    double d = 1;
+    walk.Reset();
 
     for (int i = 0; i < o.size(); ++i) {
-        assert(frontier.size() > 0);
-        assert(frontier.find(o[i]) != end(frontier));
-        cur.push_back(frontier.size());
-
-        auto choice = o[i];
-        for (auto e : choice->outEdges) {
-            if (e->IsDirected()) {
-                if (--inDegree[e->to] == 0) {
-                    frontier.insert(e->to);
-                }
-            }
-        }
-
-        frontier.erase(choice);
+        assert(!walk.Done());
+        d = d / walk.Frontier().size();
+        walk.Schedule(o[i]->id);
     }
 
-    assert(frontier.size() == 0);
+    assert(walk.Done());
 
-    f.factors.push_back(cur);
+    f.Add(d);
 }
 
-void AccountBPOSBound(AddFactor & f, Graph * g, const vector<Vertex *> & o) {
-    MulFactor cur;
-    set<Vertex *> scheduled;
-    set<Vertex *> frontier;
-    map<Vertex *, set<Vertex *>> happensBefore;
-    map<Vertex *, set<Vertex *>> startsBefore;
-    map<Vertex *, set<Vertex *>> priDep;
-    map<Vertex *, int> inDegree;
-
-    for (auto v : g->vertices) {
-        int d = 0;
-        for (auto e : v->inEdges) {
-            if (e->IsDirected()) {
-                ++d;
-            }
-        }
-
-        inDegree[v] = d;
-        if (d == 0) {
-            frontier.insert(v);
-        }
-    }
+void AccountBPOSBound(ProbAcc & f, TopoWalk & walk, const vector<Vertex *> & o) {
+    double p = 1;
+    const CsrGraph & csr = walk.GetGraph();
+    vector<bool> scheduled(csr.Size(), false);
+    vector<set<int>> happensBefore(csr.Size());
+    vector<set<int>> startsBefore(csr.Size());
+    vector<set<int>> priDep(csr.Size());
+    walk.Reset();
 
     for (int i = 0; i < o.size(); ++i) {
-        assert(frontier.size() > 0);
-        assert(frontier.find(o[i]) != end(frontier));
-        auto choice = o[i];
-
-        for (auto e : choice->outEdges) {
-            if (!e->IsDirected() &&
-                scheduled.find(e->to) != end(scheduled) &&
-                startsBefore[choice].find(e->to) == end(startsBefore[choice])) {
-
-                priDep[choice].insert(e->to);
-                priDep[choice].insert(priDep[e->to].begin(), priDep[e->to].end());
-                for (auto v : startsBefore[e->to]) {
+        int choice = o[i]->id;
+
+        for (auto d = csr.DepBegin(choice); d != csr.DepEnd(choice); ++d) {
+            if (scheduled[*d] &&
+                startsBefore[choice].find(*d) == end(startsBefore[choice])) {
+
+                priDep[choice].insert(*d);
+                priDep[choice].insert(priDep[*d].begin(), priDep[*d].end());
+                for (auto v : startsBefore[*d]) {
                     if (startsBefore[choice].find(v) == end(startsBefore[choice])) {
                         priDep[choice].insert(v);
                         priDep[choice].insert(priDep[v].begin(), priDep[v].end());
                     }
                 }
-                happensBefore[choice].insert(e->to);
-                happensBefore[choice].insert(happensBefore[e->to].begin(), happensBefore[e->to].end());
+                happensBefore[choice].insert(*d);
+                happensBefore[choice].insert(happensBefore[*d].begin(), happensBefore[*d].end());
             }
         }
 
-        for (auto e : choice->outEdges) {
-            if (e->IsDirected()) {
-                happensBefore[e->to].insert(choice);
-                happensBefore[e->to].insert(happensBefore[choice].begin(), happensBefore[choice].end());
+        for (auto s = csr.SuccBegin(choice); s != csr.SuccEnd(choice); ++s) {
+            happensBefore[*s].insert(choice);
+            happensBefore[*s].insert(happensBefore[choice].begin(), happensBefore[choice].end());
+        }
 
-                if (--inDegree[e->to] == 0) {
-                    startsBefore[e->to] = happensBefore[e->to];
-                    frontier.insert(e->to);
-                }
-            }
+        walk.Schedule(choice);
+        for (auto v : walk.Enabled()) {
+            startsBefore[v] = happensBefore[v];
         }
 
-        cur.push_back(priDep[choice].size() + 1);
+        p = p / (priDep[choice].size() + 1);
 
-        frontier.erase(choice);
-        scheduled.insert(choice);
+        scheduled[choice] = true;
 
-        // cout << choice->id << ' ' << happensBefore[choice] << ' ' << startsBefore[choice] << ' ' << priDep[choice] << endl;
+        // cout << choice << ' ' << happensBefore[choice] << ' ' << startsBefore[choice] << ' ' << priDep[choice] << endl;
     }
 
-    f.factors.push_back(cur);
+    f.Add(p);
 }
 
-void AccountPOSBound(AddFactor & f, Graph * g, const vector<Vertex *> & o) {
-    MulFactor cur;
-    set<Vertex *> scheduled;
-    set<Vertex *> frontier;
-    map<Vertex *, set<Vertex *>> happensBefore;
-    map<Vertex *, set<Vertex *>> startsBefore;
-    map<Vertex *, int> inDegree;
-
-    for (auto v : g->vertices) {
-        int d = 0;
-        for (auto e : v->inEdges) {
-            if (e->IsDirected()) {
-                ++d;
-            }
-        }
-
-        inDegree[v] = d;
-        if (d == 0) {
-            frontier.insert(v);
-        }
-    }
+void AccountPOSBound(ProbAcc & f, TopoWalk & walk, const vector<Vertex *> & o) {
+    double p = 1;
+    const CsrGraph & csr = walk.GetGraph();
+    vector<bool> scheduled(csr.Size(), false);
+    vector<set<int>> happensBefore(csr.Size());
+    vector<set<int>> startsBefore(csr.Size());
+    walk.Reset();
 
     for (int i = 0; i < o.size(); ++i) {
-        assert(frontier.size() > 0);
-        assert(frontier.find(o[i]) != end(frontier));
-        auto choice = o[i];
+        int choice = o[i]->id;
 
         int updCount = 0;
 
-        for (auto e : choice->outEdges) {
-            if (!e->IsDirected() &&
-                scheduled.find(e->to) != end(scheduled) &&
-                startsBefore[choice].find(e->to) == end(startsBefore[choice])) {
+        for (auto d = csr.DepBegin(choice); d != csr.DepEnd(choice); ++d) {
+            if (scheduled[*d] &&
+                startsBefore[choice].find(*d) == end(startsBefore[choice])) {
 
                 ++updCount;
 
-                happensBefore[choice].insert(e->to);
-                happensBefore[choice].insert(happensBefore[e->to].begin(), happensBefore[e->to].end());
+                happensBefore[choice].insert(*d);
+                happensBefore[choice].insert(happensBefore[*d].begin(), happensBefore[*d].end());
             }
         }
 
-        for (auto e : choice->outEdges) {
-            if (e->IsDirected()) {
-                happensBefore[e->to].insert(choice);
-                happensBefore[e->to].insert(happensBefore[choice].begin(), happensBefore[choice].end());
+        for (auto s = csr.SuccBegin(choice); s != csr.SuccEnd(choice); ++s) {
+            happensBefore[*s].insert(choice);
+            happensBefore[*s].insert(happensBefore[choice].begin(), happensBefore[choice].end());
+        }
 
-                if (--inDegree[e->to] == 0) {
-                    startsBefore[e->to] = happensBefore[e->to];
-                    frontier.insert(e->to);
-                }
-            }
+        walk.Schedule(choice);
+        for (auto v : walk.Enabled()) {
+            startsBefore[v] = happensBefore[v];
         }
 
         if (updCount > 0) {
@@ -340,19 +246,18 @@ void AccountPOSBound(AddFactor & f, Graph * g, const vector<Vertex *> & o) {
                 if (i < rem) d *= pSize / updCount + 2;
                 else d *= pSize / updCount + 1;
             }
-            cur.push_back(d);
+            p = p / d;
         }
 
-        frontier.erase(choice);
-        scheduled.insert(choice);
+        scheduled[choice] = true;
 
-        // cout << choice->id << ' ' << happensBefore[choice] << ' ' << startsBefore[choice] << ' ' << priDep[choice] << endl;
+        // cout << choice << ' ' << happensBefore[choice] << ' ' << startsBefore[choice] << endl;
     }
 
-    f.factors.push_back(cur);
+    f.Add(p);
 }
 
-void PCTSample(Graph * g, const map<Vertex *, int> & threadId, const vector<int> & initPri, const vector<int> & dp, vector<Vertex *> & order) {
+void PCTSample(TopoWalk & walk, const vector<int> & threadId, const vector<int> & initPri, const vector<int> & dp, vector<Vertex *> & order) {
     order.clear();
 
     vector<int> pri = initPri;
@@ -363,30 +268,17 @@ void PCTSample(Graph * g, const map<Vertex *, int> & threadId, const vector<int>
     started.resize(pri.size(), true);
 #endif
 
-    map<Vertex *, int> inDegree;
-    set<Vertex *> frontier;
-
-    for (auto v : g->vertices) {
-        int d = 0;
-        for (auto e : v->inEdges) {
-            if (e->IsDirected()) {
-                ++d;
-            }
-        }
-
-        inDegree[v] = d;
-        if (d == 0) {
-            frontier.insert(v);
-        }
-    }
+    const CsrGraph & csr = walk.GetGraph();
+    walk.Reset();
+    auto & frontier = walk.Frontier();
 
     int step = 0;
     while (frontier.size() > 0) {
-        Vertex * choice = nullptr;
+        int choice = -1;
         int choiceT;
         for (auto v : frontier) {
-            int t = threadId.at(v);
-            if (choice == nullptr || pri[t] > pri[choiceT]) {
+            int t = threadId[v];
+            if (choice < 0 || pri[t] > pri[choiceT]) {
                 choice = v;
                 choiceT = t;
             }
@@ -406,16 +298,8 @@ void PCTSample(Graph * g, const map<Vertex *, int> & threadId, const vector<int>
         }
 
         if (started[choiceT]) {
-            for (auto e : choice->outEdges) {
-                if (e->IsDirected()) {
-                    if (--inDegree[e->to] == 0) {
-                        frontier.insert(e->to);
-                    }
-                }
-            }
-
-            frontier.erase(choice);
-            order.push_back(choice);
+            walk.Schedule(choice);
+            order.push_back(csr.vertices[choice]);
         }
         else {
             started[choiceT] = true;
@@ -424,50 +308,132 @@ void PCTSample(Graph * g, const map<Vertex *, int> & threadId, const vector<int>
     }
 }
 
-int main(int argc, char ** argv) {
-    Graph * g = new Graph();
-    Graph * gr = new Graph(); // with extra read-read dep
+void IdsToOrder(const CsrGraph & g, const vector<int> & ids, vector<Vertex *> & order) {
+    order.resize(ids.size());
+    for (int i = 0; i < ids.size(); ++i) {
+        order[i] = g.vertices[ids[i]];
+    }
+}
 
-    map<string, int> nameToId;
-    map<int, string> idToName;
+// Per-thread state of a sampling run
+struct SampleWorker {
+    SamplerWorkspace ws;
+    vector<int> ids;
+    vector<Vertex *> order;
 
-    string line;
-    bool rrDep = false;
-    while (getline(cin, line)) {
-        if (line.size() > 0 && line[0] == '#') {
-            if (line.find("# RRDEP") == 0)
-                rrDep = true;
-            continue;
-        }
+    SampleWorker(const CsrGraph & g) : ws(g), ids(g.Size()) { }
+};
 
-        stringstream ss(line);
-        string src, dst;
-        int dir;
-        if (!(ss >> src >> dst >> dir)) continue;
+// Seed of the engine of sample i, from the splitmix64 finalizer of seed and
+// i, so that a worker can start at any sample without stepping through the
+// ones before it
+static inline uint64_t SampleSeed(long seed, long i) {
+    uint64_t z = (uint64_t)seed + (uint64_t)(i + 1) * 0x9E3779B97F4A7C15ULL;
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+}
+
+// Samples blockBegin to blockEnd of RunSampling
+void RunSampleBlock(Graph * g, const CsrGraph & sampleGraph,
+                    Trace::IClassifier * classifier, const string & classifierName,
+                    long blockBegin, long blockEnd, long seed, int threads,
+                    const function<void(SampleWorker &, random_engine &)> & sample,
+                    const function<void(int, long)> & account) {
+    struct ShardClass {
+        vector<Vertex *> order;
+        long hits;
+    };
+
+    long times = blockEnd - blockBegin;
+    vector<vector<ShardClass>> shards(threads);
+    auto worker = [&](int t) {
+        long begin = blockBegin + times * t / threads;
+        long end = blockBegin + times * (t + 1) / threads;
+        SampleWorker w(sampleGraph);
+        unique_ptr<Trace::IClassifier> shard(Trace::CreateClassifier(classifierName, g));
+        auto & classes = shards[t];
+
+        for (long i = begin; i < end; ++i) {
+            random_engine algoRe(SampleSeed(seed, i));
+            sample(w, algoRe);
+
+            bool isNew;
+            int cls = shard->Classify(w.order, isNew);
+            if (isNew) {
+                classes.push_back(ShardClass{ w.order, 1 });
+            }
+            else {
+                ++classes[cls].hits;
+            }
+        }
+    };
 
-        if (nameToId.find(src) == end(nameToId)) {
-            g->NewVertex();
-            gr->NewVertex();
-            int id = nameToId.size();
-            nameToId[src] = id;
-            idToName[nameToId[src]] = src;
+    if (threads == 1) {
+        worker(0);
+    }
+    else {
+        vector<thread> pool;
+        for (int t = 0; t < threads; ++t) {
+            pool.emplace_back(worker, t);
         }
+        for (auto && th : pool) {
+            th.join();
+        }
+    }
 
-        if (nameToId.find(dst) == end(nameToId)) {
-            g->NewVertex();
-            gr->NewVertex();
-            int id = nameToId.size();
-            nameToId[dst] = id;
-            idToName[nameToId[dst]] = dst;
+    for (auto && classes : shards) {
+        for (auto && c : classes) {
+            bool isNew;
+            account(classifier->Classify(c.order, isNew), c.hits);
         }
+    }
+}
 
-        if (!rrDep) g->AddEdge(g->vertices[nameToId[src]], g->vertices[nameToId[dst]], !!dir);
-        gr->AddEdge(gr->vertices[nameToId[src]], gr->vertices[nameToId[dst]], !!dir);
+// Runs samples `first` to `times` in blocks of SAMPLE_BLOCK, each split into
+// contiguous chunks over `threads` workers. Sample i always seeds its engine
+// with SampleSeed(seed, i) and every worker classifies its traces in a
+// private classifier shard of the same kind. Shards are merged
+// into `classifier` in sample order, so the hit counts handed to `account` do
+// not depend on the number of threads nor on where the run was resumed.
+// `done` gets the number of samples finished after every block.
+void RunSampling(Graph * g, const CsrGraph & sampleGraph,
+                 Trace::IClassifier * classifier, const string & classifierName,
+                 long times, long seed, int threads, long first,
+                 const function<void(SampleWorker &, random_engine &)> & sample,
+                 const function<void(int, long)> & account,
+                 const function<void(long)> & done) {
+    for (long blockBegin = first; blockBegin < times; blockBegin += SAMPLE_BLOCK) {
+        long blockEnd = min(times, blockBegin + SAMPLE_BLOCK);
+        RunSampleBlock(g, sampleGraph, classifier, classifierName, blockBegin, blockEnd,
+                       seed, threads, sample, account);
+        done(blockEnd);
     }
+}
+
+// Ground-truth statistics of one subtree of the enumeration, per class in
+// the order the subtree discovers them
+struct GroundTruthShard {
+    struct Class {
+        vector<Vertex *> trace; // first order of the class in the subtree
+        set<tuple<Vertex *, Vertex *>> races;
+        ProbAcc rw;
+        ProbAcc bpos;
+        ProbAcc pos;
+        int preemption;
+    };
+
+    vector<Class> classes;
+    long orders;
+
+    GroundTruthShard() : orders(0) { }
+};
 
-    long toCount = 0;
-    auto porTree = new PorTree(g);
-    auto e = Systematic::CreateDfsExplorer(false);
+void ExploreSubtree(Graph * g, const vector<Vertex *> & prefix, const string & classifierName,
+                    GroundTruthShard & shard) {
+    TopoWalk walk(g->Freeze());
+    unique_ptr<Trace::IClassifier> classifier(Trace::CreateClassifier(classifierName, g));
+    unique_ptr<Systematic::IExplorer> e(Systematic::CreateDfsExplorer(prefix, false));
     e->Begin(g);
     vector<Vertex *> order;
     while (true) {
@@ -482,45 +448,413 @@ int main(int argc, char ** argv) {
                 cout << endl;
             });
 
-        auto poNode = porTree->AddPath(order);
-        AccountRWBound(rwBound[poNode], g, order);
-        int pmpt = GetPreemption(g, order);
-        {
-            GetRaces(g, order, races[poNode]);
+        bool isNew;
+        int c = classifier->Classify(order, isNew);
+        if (isNew) {
+            shard.classes.push_back(GroundTruthShard::Class());
+            auto & k = shard.classes.back();
+            k.trace = order;
+            k.preemption = -1;
+            AccountBPOSBound(k.bpos, walk, order);
+            AccountPOSBound(k.pos, walk, order);
         }
-        if (preemptionNeeded.find(poNode) == end(preemptionNeeded) ||
-            preemptionNeeded[poNode] > pmpt) {
-            preemptionNeeded[poNode] = pmpt;
+
+        auto & k = shard.classes[c];
+        AccountRWBound(k.rw, walk, order);
+        int pmpt = GetPreemption(walk, order);
+        GetRaces(walk, order, k.races);
+        if (k.preemption < 0 || k.preemption > pmpt) {
+            k.preemption = pmpt;
         }
-        if (poNode->minHit == 1) {
-            trace[poNode] = order;
-            AccountBPOSBound(bposBound[poNode], g, order);
-            AccountPOSBound(posBound[poNode], g, order);
+        ++shard.orders;
+    }
+    e->End();
+}
+
+// A run goes through these phases in order. A snapshot records the phase in
+// progress and how far it got (merged subtrees, samples done), besides the
+// per-class columns and the first order of every class. That is all a later
+// run needs to go on: the classifier is rebuilt by classifying the stored
+// orders again in class order, and sample i of a phase only depends on i.
+enum Phase {
+    PHASE_GROUND_TRUTH,
+    PHASE_PCT,
+    PHASE_RAPOS,
+    PHASE_BPOS,
+    PHASE_POS,
+    PHASE_RPOS,
+};
+
+struct Progress {
+    int phase;
+    long step;
+};
+
+static const char SNAPSHOT_MAGIC[8] = { 'C', 'A', 'L', 'C', 'S', 'N', 'P', '2' };
+
+template <typename T>
+void Put(ostream & out, const T & v) {
+    out.write((const char *)&v, sizeof(T));
+}
+
+template <typename T>
+bool Take(istream & in, T & v) {
+    return !!in.read((char *)&v, sizeof(T));
+}
+
+void PutAcc(ostream & out, const ProbAcc & f) {
+    Put<int64_t>(out, f.hits);
+    Put<int64_t>(out, f.samples);
+    Put(out, f.sum);
+}
+
+bool TakeAcc(istream & in, ProbAcc & f) {
+    int64_t hits, samples;
+    if (!Take(in, hits) || !Take(in, samples) || !Take(in, f.sum)) return false;
+    f.hits = hits;
+    f.samples = samples;
+    return true;
+}
+
+// Writes to a temporary file renamed over path, so that a run killed while
+// writing leaves the previous snapshot intact
+bool SaveSnapshot(const string & path, const string & config, const Progress & progress,
+                  const BigUInt & orderCount) {
+    string tmp = path + ".tmp";
+    ofstream out(tmp.c_str(), ios::binary | ios::trunc);
+    out.write(SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC));
+    Put<uint64_t>(out, config.size());
+    out.write(config.data(), config.size());
+    Put<int32_t>(out, progress.phase);
+    Put<int64_t>(out, progress.step);
+    Put<uint32_t>(out, orderCount.Limbs().size());
+    for (auto l : orderCount.Limbs()) {
+        Put(out, l);
+    }
+
+    vector<int> ids;
+    Put<uint64_t>(out, traces.Size());
+    for (size_t c = 0; c < traces.Size(); ++c) {
+        traces.Get(c, ids);
+        for (auto v : ids) {
+            Put<int32_t>(out, v);
+        }
+        Put<int32_t>(out, preemptionNeeded[c]);
+        Put<uint64_t>(out, races[c].size());
+        for (auto && r : races[c]) {
+            Put<int32_t>(out, get<0>(r)->id);
+            Put<int32_t>(out, get<1>(r)->id);
+        }
+        for (auto col : { &rwBound, &bposBound, &posBound, &pctBound,
+                          &raposSample, &bposSample, &posSample, &rposSample }) {
+            PutAcc(out, (*col)[c]);
         }
-        ++toCount;
+    }
+
+    out.close();
+    if (!out) return false;
+    return rename(tmp.c_str(), path.c_str()) == 0;
+}
 
-        if (toCount % 1000000 == 0)
-            cerr << getpid() << ':' << toCount << endl;
+// Fills the columns, the trace store and the classifier, which must all be
+// empty, from a snapshot taken with the same configuration
+bool LoadSnapshot(const string & path, const string & config, const CsrGraph & csr,
+                  Trace::IClassifier * classifier, Progress & progress, BigUInt & orderCount) {
+    ifstream in(path.c_str(), ios::binary);
+    char magic[sizeof(SNAPSHOT_MAGIC)];
+    if (!in.read(magic, sizeof(magic)) || !equal(magic, magic + sizeof(magic), SNAPSHOT_MAGIC)) {
+        cerr << path << " is not a Calc snapshot" << endl;
+        return false;
+    }
+
+    uint64_t configSize;
+    if (!Take(in, configSize)) return false;
+    string snapConfig(configSize, '\0');
+    if (!in.read(&snapConfig[0], configSize)) return false;
+    if (snapConfig != config) {
+        cerr << path << " was taken with another case or other options" << endl;
+        return false;
+    }
+
+    int32_t phase;
+    int64_t step;
+    uint32_t limbCount;
+    if (!Take(in, phase) || !Take(in, step) || !Take(in, limbCount)) return false;
+    progress.phase = phase;
+    progress.step = step;
+    vector<uint32_t> limbs(limbCount);
+    for (auto & l : limbs) {
+        if (!Take(in, l)) return false;
+    }
+    orderCount = BigUInt(limbs);
+
+    uint64_t classCount;
+    if (!Take(in, classCount)) return false;
+    vector<int> ids(csr.Size());
+    vector<Vertex *> order;
+    for (size_t c = 0; c < classCount; ++c) {
+        for (auto & v : ids) {
+            int32_t id;
+            if (!Take(in, id) || id < 0 || id >= csr.Size()) return false;
+            v = id;
+        }
+        IdsToOrder(csr, ids, order);
+        bool isNew;
+        if (ClassIndex(classifier->Classify(order, isNew)) != c || !isNew) return false;
+        traces.Append(ids);
+
+        int32_t preemption;
+        uint64_t raceCount;
+        if (!Take(in, preemption) || !Take(in, raceCount)) return false;
+        preemptionNeeded[c] = preemption;
+        for (uint64_t i = 0; i < raceCount; ++i) {
+            int32_t a, b;
+            if (!Take(in, a) || !Take(in, b) ||
+                a < 0 || a >= csr.Size() || b < 0 || b >= csr.Size()) return false;
+            races[c].insert(make_tuple(csr.vertices[a], csr.vertices[b]));
+        }
+        for (auto col : { &rwBound, &bposBound, &posBound, &pctBound,
+                          &raposSample, &bposSample, &posSample, &rposSample }) {
+            if (!TakeAcc(in, (*col)[c])) return false;
+        }
+    }
+    return true;
+}
+
+int main(int argc, char ** argv) {
+    Graph * g = new Graph();
+    Graph * gr = new Graph(); // with extra read-read dep
+    map<string, string> opts;
+
+    {
+        regex reKv("([-_a-zA-Z.0-9]+)=(.*)");
+        for (int i = 1; i < argc; ++i) {
+            smatch m;
+            string arg(argv[i]);
+            if (regex_match(arg, m, reKv) && arg[0] != '-') {
+                opts[m[1]] = m[2];
+            }
+        }
+    }
+
+    int threads = 1;
+    if (opts.find("threads") != opts.end()) {
+        threads = max(1, stoi(opts["threads"]));
+    }
+
+    // text or binary, mapped when stdin is a file
+    Case input;
+    if (!CaseIO::Read(0, input)) {
+        cerr << "Cannot read the case" << endl;
+        return 1;
+    }
+    input.Build(g, gr);
+    const vector<string> & idToName = input.names;
+
+    // identifies the case in snapshots
+    size_t inputHash = 0;
+    for (auto && name : input.names) {
+        inputHash = inputHash * 31 + hash<string>()(name);
+    }
+    for (auto edges : { &input.poEdges, &input.depEdges, &input.rrDepEdges, &input.rrPoEdges }) {
+        inputHash = inputHash * 31 + edges->size();
+        for (auto && e : *edges) {
+            inputHash = (inputHash * 31 + e.first) * 31 + e.second;
+        }
     }
-    e->End();
 
-    cout << "Total Order Count: " << toCount << endl;
+    const CsrGraph & csr = g->Freeze();
+    TopoWalk walk(csr);
+    gr->Freeze();
+
+    string classifierName = "portree";
+    if (opts.find("classifier") != opts.end()) {
+        classifierName = opts["classifier"];
+    }
+    if (opts.find("por-check") != opts.end()) {
+        PorTree::CheckPolicy p;
+        if (!PorTree::ParseCheckPolicy(opts["por-check"], p)) {
+            cerr << "Unknown por-check policy " << opts["por-check"] << endl;
+            return 1;
+        }
+        PorTree::SetDefaultCheckPolicy(p);
+    }
+    if (opts.find("trace-store") != opts.end() && !traces.Open(opts["trace-store"])) {
+        cerr << "Cannot create trace store " << opts["trace-store"] << endl;
+        return 1;
+    }
+
+    auto classifier = Trace::CreateClassifier(classifierName, g);
+    if (classifier == nullptr) {
+        cerr << "Unknown classifier " << classifierName << endl;
+        return 1;
+    }
+
+    // Snapshots are taken at most every checkpoint-interval seconds, between
+    // two merged subtrees or sample blocks. A run with resume=FILE must get
+    // the same case, options and environment, but may use other threads.
+    string checkpointPath;
+    double checkpointInterval = 600;
+    if (opts.find("checkpoint") != opts.end()) {
+        checkpointPath = opts["checkpoint"];
+    }
+    if (opts.find("checkpoint-interval") != opts.end()) {
+        checkpointInterval = stod(opts["checkpoint-interval"]);
+    }
+
+    string config;
+    for (auto && kv : opts) {
+        if (kv.first == "threads" || kv.first == "trace-store" || kv.first == "checkpoint" ||
+            kv.first == "checkpoint-interval" || kv.first == "resume") continue;
+        config += kv.first + '=' + kv.second + '\n';
+    }
+    for (auto name : { "CALC_PCT_PARAM", "CALC_RAPOS_SAMPLE", "CALC_BPOS_SAMPLE",
+                       "CALC_POS_SAMPLE", "CALC_RPOS_SAMPLE" }) {
+        if (getenv(name)) config += string(name) + '=' + getenv(name) + '\n';
+    }
+    config += "input=" + to_string(inputHash) + '\n';
+
+    BigUInt orderCount;
+    Progress resumed{ PHASE_GROUND_TRUTH, 0 };
+    if (opts.find("resume") != opts.end() &&
+        !LoadSnapshot(opts["resume"], config, csr, classifier, resumed, orderCount)) {
+        cerr << "Cannot resume from " << opts["resume"] << endl;
+        return 1;
+    }
+
+    // where to start in a phase whose steps end at `end`
+    auto startOf = [&](int phase, long end) -> long {
+        if (resumed.phase > phase) return end;
+        return resumed.phase == phase ? resumed.step : 0;
+    };
+
+    auto lastCheckpoint = chrono::steady_clock::now();
+    auto checkpoint = [&](int phase, long step) {
+        if (checkpointPath.empty()) return;
+        auto now = chrono::steady_clock::now();
+        if (chrono::duration<double>(now - lastCheckpoint).count() < checkpointInterval) return;
+        if (!SaveSnapshot(checkpointPath, config, Progress{ phase, step }, orderCount)) {
+            cerr << "Cannot write snapshot " << checkpointPath << endl;
+        }
+        lastCheckpoint = now;
+    };
+
+    // The enumeration is cut into subtrees at a fixed depth, explored in
+    // parallel and merged in DFS order, so the result does not depend on the
+    // number of threads
+    int splitDepth = 6;
+    if (opts.find("split-depth") != opts.end()) {
+        splitDepth = stoi(opts["split-depth"]);
+    }
+
+    // "enumerate" visits every total order; "dp" takes one order per class
+    // and computes the rest of the class by dynamic programming over its
+    // downsets (Counting::AnalyzeClass), exponential only in its width
+    string groundTruth = "enumerate";
+    if (opts.find("ground-truth") != opts.end()) {
+        groundTruth = opts["ground-truth"];
+    }
+
+    if (resumed.phase > PHASE_GROUND_TRUTH) {
+        // restored from the snapshot
+    }
+    else if (groundTruth == "dp") {
+        // the sleep-set DFS yields the classes in the order the enumeration
+        // discovers them, each through its first order there
+        unique_ptr<Systematic::IExplorer> e(Systematic::CreateDfsExplorer(true));
+        e->Begin(g);
+        vector<Vertex *> order;
+        while (e->Explore(order)) {
+            bool isNew;
+            size_t c = ClassIndex(classifier->Classify(order, isNew));
+            assert(isNew && c == traces.Size());
+            traces.Append(order);
+            AccountBPOSBound(bposBound[c], walk, order);
+            AccountPOSBound(posBound[c], walk, order);
+        }
+        e->End();
+
+        vector<Counting::ClassStats> stats(traces.Size());
+        Systematic::RunOrdered(traces.Size(), threads,
+                               [&](int c) {
+                                   vector<int> ids;
+                                   traces.Get(c, ids);
+                                   Counting::AnalyzeClass(csr, ids, stats[c]);
+                               },
+                               [&](int c) {
+                                   rwBound[c].Add(stats[c].rw);
+                                   preemptionNeeded[c] = stats[c].minPreemption;
+                                   for (auto && r : stats[c].races) {
+                                       races[c].insert(make_tuple(csr.vertices[r.first], csr.vertices[r.second]));
+                                   }
+                                   orderCount += stats[c].orders;
+                                   stats[c] = Counting::ClassStats();
+                               });
+        checkpoint(PHASE_PCT, 0);
+    }
+    else if (groundTruth == "enumerate") {
+        auto prefixes = Systematic::SplitDfs(g, splitDepth, false);
+        vector<unique_ptr<GroundTruthShard>> gtShards(prefixes.size());
+        long first = startOf(PHASE_GROUND_TRUTH, prefixes.size());
+        long toCount = orderCount.Saturated();
+        Systematic::RunOrdered(prefixes.size() - first, threads,
+                               [&](int t) {
+                                   t += first;
+                                   gtShards[t].reset(new GroundTruthShard());
+                                   ExploreSubtree(g, prefixes[t], classifierName, *gtShards[t]);
+                               },
+                               [&](int t) {
+                                   t += first;
+                                   auto & shard = *gtShards[t];
+                                   for (auto && k : shard.classes) {
+                                       bool isNew;
+                                       size_t c = ClassIndex(classifier->Classify(k.trace, isNew));
+                                       rwBound[c].Merge(k.rw);
+                                       races[c].insert(k.races.begin(), k.races.end());
+                                       if (preemptionNeeded[c] < 0 || preemptionNeeded[c] > k.preemption) {
+                                           preemptionNeeded[c] = k.preemption;
+                                       }
+                                       if (isNew) {
+                                           traces.Append(k.trace);
+                                           bposBound[c] = k.bpos;
+                                           posBound[c] = k.pos;
+                                       }
+                                   }
+
+                                   if ((toCount + shard.orders) / 1000000 > toCount / 1000000)
+                                       cerr << getpid() << ':' << toCount + shard.orders << endl;
+                                   toCount += shard.orders;
+                                   orderCount = BigUInt(toCount);
+                                   gtShards[t].reset();
+                                   checkpoint(PHASE_GROUND_TRUTH, t + 1);
+                               });
+    }
+    else {
+        cerr << "Unknown ground truth " << groundTruth << endl;
+        return 1;
+    }
+
+    // classes found by the exhaustive exploration, in discovery order
+    size_t classCount = classifier->ClassCount();
+
+    cout << "Total Order Count: " << orderCount.ToString() << endl;
     int max_preemption = -1;
-    for (auto && kv : preemptionNeeded) {
-        if (max_preemption < 0 || max_preemption < get<1>(kv)) {
-            max_preemption = get<1>(kv);
+    for (auto p : preemptionNeeded) {
+        if (max_preemption < 0 || max_preemption < p) {
+            max_preemption = p;
         }
     }
 
     int maxRaces = -1;
-    for (auto && kv : races) {
-        if (maxRaces < 0 || maxRaces < get<1>(kv).size()) {
-            maxRaces = get<1>(kv).size();
+    for (auto && r : races) {
+        if (maxRaces < 0 || maxRaces < r.size()) {
+            maxRaces = r.size();
         }
     }
     cout << "Max Preemptions: " << max_preemption << endl;
     cout << "Max Races: " << maxRaces << endl;
-    cout << "Total PO traces: " << porTree->GetRoot()->size << endl;
+    cout << "Total PO traces: " << classCount << endl;
+    cerr << "Classifier Peak Bytes: " << classifier->PeakBytes() << endl;
 
     bool hasPCT = false;
     // accounting for PCT
@@ -535,28 +869,20 @@ int main(int argc, char ** argv) {
             ss >> seed;
         }
 
-        map<char, int> tcToId;
-        for (auto v : g->vertices) {
-            char tc = idToName[v->id][0];
-            if (tcToId.find(tc) == end(tcToId)) {
-                int id = tcToId.size();
-                tcToId[tc] = id;
-            }
-        }
-
-        map<Vertex *, int> threadId;
-        for (auto v : g->vertices) {
-            threadId[v] = tcToId[idToName[v->id][0]];
-        }
+        const vector<int> & threadId = input.threadIds;
 
         if (pct_n <= 0) pct_n = g->vertices.size();
         if (pct_d < 0) {
             pct_d = max_preemption - 1 - pct_d;
         }
 
-        if (sample_count <= 0) {
+        if (sample_count <= 0 && startOf(PHASE_PCT, 1) > 0) {
+            // enumerated before resuming
+        }
+        else if (sample_count <= 0) {
+            vector<Vertex *> order;
             vector<int> threadInitPri;
-            for (int i = 0; i < tcToId.size(); ++i) {
+            for (int i = 0; i < input.threadCount; ++i) {
                 threadInitPri.push_back(i);
             }
 
@@ -585,7 +911,7 @@ int main(int argc, char ** argv) {
                     //     cout << endl;
                     // }
 
-                    PCTSample(g, threadId, threadInitPri, dp, order);
+                    PCTSample(walk, threadId, threadInitPri, dp, order);
 
                     // {
                     //     cout << "trace ";
@@ -598,15 +924,16 @@ int main(int argc, char ** argv) {
                     //     cout << endl;
                     // }
                     // simulation finished, do accounting and prepare next run
-                    auto poNode = porTree->AddPath(order);
-                    MulFactor cur;
-                    for (int i = 0; i < tcToId.size(); ++i) {
-                        cur.push_back(i + 1);
+                    bool isNew;
+                    int cls = classifier->Classify(order, isNew);
+                    double p = 1;
+                    for (int i = 0; i < input.threadCount; ++i) {
+                        p = p / (i + 1);
                     }
                     for (int i = 0; i < pct_d; ++i) {
-                        cur.push_back(pct_n);
+                        p = p / pct_n;
                     }
-                    pctBound[poNode].factors.push_back(cur);
+                    pctBound[ClassIndex(cls)].Add(p);
 
                     bool nextRound = false;
                     for (int i = 0; i < dp.size(); ++i) {
@@ -628,36 +955,35 @@ int main(int argc, char ** argv) {
                     if (!nextRound) break;
                 }
             } while (next_permutation(threadInitPri.begin(), threadInitPri.end()));
+            checkpoint(PHASE_RAPOS, 0);
         }
         else {
-            random_engine meta_rng(seed);
-            for (int itr = 0; itr < sample_count; ++itr) {
-                random_engine rng(meta_rng());
-
-                vector<int> threadInitPri;
-                for (int i = 0; i < tcToId.size(); ++i) {
-                    threadInitPri.push_back(i);
-                }
-                shuffle(begin(threadInitPri), end(threadInitPri), rng);
+            RunSampling(g, csr, classifier, classifierName, sample_count, seed, threads,
+                        startOf(PHASE_PCT, sample_count),
+                        [&](SampleWorker & w, random_engine & rng) {
+                            vector<int> threadInitPri;
+                            for (int i = 0; i < input.threadCount; ++i) {
+                                threadInitPri.push_back(i);
+                            }
+                            shuffle(begin(threadInitPri), end(threadInitPri), rng);
 
 #if PCT_DUMMY_START
-                uniform_int_distribution<int> dist(0, pct_n - 1 + threadInitPri.size());
+                            uniform_int_distribution<int> dist(0, pct_n - 1 + threadInitPri.size());
 #else
-                uniform_int_distribution<int> dist(0, pct_n - 1);
+                            uniform_int_distribution<int> dist(0, pct_n - 1);
 #endif
 
-                vector<int> dp;
-                for (int i = 0; i < pct_d; ++i) {
-                    dp.push_back(dist(rng));
-                }
-
-                PCTSample(g, threadId, threadInitPri, dp, order);
+                            vector<int> dp;
+                            for (int i = 0; i < pct_d; ++i) {
+                                dp.push_back(dist(rng));
+                            }
 
-                auto poNode = porTree->AddPath(order);
-                MulFactor cur;
-                cur.push_back(sample_count);
-                pctBound[poNode].factors.push_back(cur);
-            }
+                            PCTSample(w.ws.walk, threadId, threadInitPri, dp, w.order);
+                        },
+                        [&](int cls, long hits) {
+                            pctBound[ClassIndex(cls)].AddHits(hits, sample_count);
+                        },
+                        [&](long done) { checkpoint(PHASE_PCT, done); });
         }
 
         hasPCT = true;
@@ -668,18 +994,17 @@ int main(int argc, char ** argv) {
         stringstream ss(getenv("CALC_RAPOS_SAMPLE"));
         long times, seed;
         ss >> times >> seed;
-        random_engine re(seed);
-        for (int i = 0; i < times; ++i) {
-            map<Vertex *, int> orderMap;
-            random_engine algoRe(re());
-            Misc::Rapos(g, algoRe, orderMap, order);
-
-            auto poNode = porTree->AddPath(order);
-            assert(poNode->minHit > 1);
-            MulFactor f;
-            f.push_back(times);
-            raposSample[poNode].factors.push_back(f);
-        }
+        RunSampling(g, csr, classifier, classifierName, times, seed, threads,
+                    startOf(PHASE_RAPOS, times),
+                    [&](SampleWorker & w, random_engine & rng) {
+                        Misc::Rapos(rng, w.ws, w.ids.data());
+                        IdsToOrder(csr, w.ids, w.order);
+                    },
+                    [&](int cls, long hits) {
+                        assert(cls < classCount);
+                        raposSample[ClassIndex(cls)].AddHits(hits, times);
+                    },
+                    [&](long done) { checkpoint(PHASE_RAPOS, done); });
         hasRAPOSSample = true;
     }
 
@@ -688,17 +1013,16 @@ int main(int argc, char ** argv) {
         stringstream ss(getenv("CALC_BPOS_SAMPLE"));
         long times, seed;
         ss >> times >> seed;
-        random_engine re(seed);
-        for (int i = 0; i < times; ++i) {
-            map<Vertex *, int> orderMap;
-            random_engine algoRe(re());
-            Pos::Basic(g, algoRe, orderMap, order);
-
-            auto poNode = porTree->AddPath(order);
-            MulFactor f;
-            f.push_back(times);
-            bposSample[poNode].factors.push_back(f);
-        }
+        RunSampling(g, csr, classifier, classifierName, times, seed, threads,
+                    startOf(PHASE_BPOS, times),
+                    [&](SampleWorker & w, random_engine & rng) {
+                        Pos::Basic(rng, w.ws, w.ids.data());
+                        IdsToOrder(csr, w.ids, w.order);
+                    },
+                    [&](int cls, long hits) {
+                        bposSample[ClassIndex(cls)].AddHits(hits, times);
+                    },
+                    [&](long done) { checkpoint(PHASE_BPOS, done); });
         hasBPOSSample = true;
     }
 
@@ -707,17 +1031,16 @@ int main(int argc, char ** argv) {
         stringstream ss(getenv("CALC_POS_SAMPLE"));
         long times, seed;
         ss >> times >> seed;
-        random_engine re(seed);
-        for (int i = 0; i < times; ++i) {
-            map<Vertex *, int> orderMap;
-            random_engine algoRe(re());
-            Pos::DependencyBased(g, algoRe, orderMap, order);
-
-            auto poNode = porTree->AddPath(order);
-            MulFactor f;
-            f.push_back(times);
-            posSample[poNode].factors.push_back(f);
-        }
+        RunSampling(g, csr, classifier, classifierName, times, seed, threads,
+                    startOf(PHASE_POS, times),
+                    [&](SampleWorker & w, random_engine & rng) {
+                        Pos::DependencyBased(rng, w.ws, w.ids.data());
+                        IdsToOrder(csr, w.ids, w.order);
+                    },
+                    [&](int cls, long hits) {
+                        posSample[ClassIndex(cls)].AddHits(hits, times);
+                    },
+                    [&](long done) { checkpoint(PHASE_POS, done); });
         hasPOSSample = true;
     }
 
@@ -726,22 +1049,18 @@ int main(int argc, char ** argv) {
         stringstream ss(getenv("CALC_RPOS_SAMPLE"));
         long times, seed;
         ss >> times >> seed;
-        random_engine re(seed);
-        for (int i = 0; i < times; ++i) {
-            map<Vertex *, int> orderMap;
-            random_engine algoRe(re());
-
-            Pos::DependencyBased(gr, algoRe, orderMap, order);
-            for (int i = 0; i < order.size(); ++i) {
-                assert(g->vertices.at(order[i]->id)->id == order[i]->id);
-                order[i] = g->vertices.at(order[i]->id);
-            }
-
-            auto poNode = porTree->AddPath(order);
-            MulFactor f;
-            f.push_back(times);
-            rposSample[poNode].factors.push_back(f);
-        }
+        // sampled on gr, which shares vertex ids with g
+        const CsrGraph & rCsr = gr->Freeze();
+        RunSampling(g, rCsr, classifier, classifierName, times, seed, threads,
+                    startOf(PHASE_RPOS, times),
+                    [&](SampleWorker & w, random_engine & rng) {
+                        Pos::DependencyBased(rng, w.ws, w.ids.data());
+                        IdsToOrder(csr, w.ids, w.order);
+                    },
+                    [&](int cls, long hits) {
+                        rposSample[ClassIndex(cls)].AddHits(hits, times);
+                    },
+                    [&](long done) { checkpoint(PHASE_RPOS, done); });
         hasRPOSSample = true;
     }
 
@@ -752,22 +1071,24 @@ int main(int argc, char ** argv) {
 
     cout << endl;
 
+    vector<int> ids;
     cout << "po trace,preemption,races" << endl;
-    for (auto && kv : preemptionNeeded) {
+    for (size_t c = 0; c < classCount; ++c) {
         {
             cout << '"';
+            traces.Get(c, ids);
             bool first = true;
-            for (auto v : trace[get<0>(kv)]) {
+            for (auto v : ids) {
                 if (first) first = false;
                 else cout << "->";
-                cout << idToName[v->id];
+                cout << idToName[v];
             }
             cout << '"';
         }
-        cout << ',' << get<1>(kv);
-        ++preemptionStat[get<1>(kv)];
+        cout << ',' << preemptionNeeded[c];
+        ++preemptionStat[preemptionNeeded[c]];
 
-        cout << ',' << races[get<0>(kv)].size();
+        cout << ',' << races[c].size();
 
         cout << endl;
     }
@@ -809,34 +1130,35 @@ int main(int argc, char ** argv) {
 
     cout << endl;
 
-    for (auto && kv : rwBound) {
+    for (size_t c = 0; c < classCount; ++c) {
         {
             cout << '"';
+            traces.Get(c, ids);
             bool first = true;
-            for (auto v : trace[get<0>(kv)]) {
+            for (auto v : ids) {
                 if (first) first = false;
                 else cout << "->";
-                cout << idToName[v->id];
+                cout << idToName[v];
             }
             cout << '"';
         }
 
-        map<string, AddFactor> row;
-        row["RW"] = get<1>(kv);
-        row["BPOS"] = bposBound[get<0>(kv)];
-        row["POS"] = posBound[get<0>(kv)];
-        if (hasPCT) row["PCT"] = pctBound[get<0>(kv)];
-        if (hasRAPOSSample) row["RAPOS-Sample"] = raposSample[get<0>(kv)];
-        if (hasBPOSSample) row["BPOS-Sample"] = bposSample[get<0>(kv)];
-        if (hasPOSSample) row["POS-Sample"] = posSample[get<0>(kv)];
-        if (hasRPOSSample) row["RPOS-Sample"] = rposSample[get<0>(kv)];
+        map<string, ProbAcc> row;
+        row["RW"] = rwBound[c];
+        row["BPOS"] = bposBound[c];
+        row["POS"] = posBound[c];
+        if (hasPCT) row["PCT"] = pctBound[c];
+        if (hasRAPOSSample) row["RAPOS-Sample"] = raposSample[c];
+        if (hasBPOSSample) row["BPOS-Sample"] = bposSample[c];
+        if (hasPOSSample) row["POS-Sample"] = posSample[c];
+        if (hasRPOSSample) row["RPOS-Sample"] = rposSample[c];
 
         for (auto && name : colOrder) {
             double p = Calc(row[name]);
             distribution[name].push_back(p);
             cout << ',' << p;
             total[name] += p;
-            if (row[name].factors.size() > 0) {
+            if (row[name].hits > 0) {
                 ++coverage[name];
                 if (min.find(name) == end(min) ||
                     min[name] > p) {
@@ -886,5 +1208,5 @@ int main(int argc, char ** argv) {
     }
     cout << endl;
 
-    delete porTree;
+    delete classifier;
 }
@@ -0,0 +1,20 @@
+#include "CaseIO.hpp"
+#include <iostream>
+
+using namespace std;
+
+// Converts a case read from stdin, such as the .graph files in examples/ or
+// the text output of DataGen, to the binary case format on stdout
+int main() {
+    Case input;
+    if (!CaseIO::Read(0, input)) {
+        cerr << "Cannot read the case" << endl;
+        return 1;
+    }
+
+    if (!CaseIO::WriteBinary(cout, input)) {
+        cerr << "Cannot write the case" << endl;
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,226 @@
+#include "CaseIO.hpp"
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace std;
+
+// "PORCASE" and a version; the header is followed by, in 32-bit words:
+//   vertex count, thread count, po edge count, dep edge count,
+//   rr dep edge count, rr po edge count, name bytes,
+//   thread id of every vertex,
+//   po edges, dep edges, rr dep edges, rr po edges as (from, to) pairs,
+//   end offset of every name in the names table,
+// and then the names table, without separators. Version 1 had no rr po
+// edges and is still read.
+static const char CASE_MAGIC[8] = { 'P', 'O', 'R', 'C', 'A', 'S', 'E', '\0' };
+#define CASE_VERSION 2
+
+void Case::AddEdge(const string & src, const string & dst, bool directed, bool rrDep) {
+    int ids[2];
+    const string * ends[2] = { &src, &dst };
+    for (int i = 0; i < 2; ++i) {
+        auto it = nameToId.find(*ends[i]);
+        if (it == nameToId.end()) {
+            int id = names.size();
+            nameToId[*ends[i]] = id;
+            names.push_back(*ends[i]);
+
+            size_t sep = ends[i]->find('_');
+            string thread = ends[i]->substr(0, sep == string::npos ? 1 : sep);
+            auto t = threadOfName.find(thread);
+            if (t == threadOfName.end()) {
+                t = threadOfName.insert(make_pair(thread, threadCount++)).first;
+            }
+            threadIds.push_back(t->second);
+            ids[i] = id;
+        }
+        else {
+            ids[i] = it->second;
+        }
+    }
+
+    auto & edges = rrDep
+        ? (directed ? rrPoEdges : rrDepEdges)
+        : (directed ? poEdges : depEdges);
+    edges.push_back(make_pair(ids[0], ids[1]));
+}
+
+void Case::Build(Graph * g, Graph * gr) const {
+    for (size_t i = 0; i < names.size(); ++i) {
+        g->NewVertex();
+        gr->NewVertex();
+    }
+    g->AddEdges(poEdges, true);
+    g->AddEdges(depEdges, false);
+    gr->AddEdges(poEdges, true);
+    gr->AddEdges(rrPoEdges, true);
+    gr->AddEdges(depEdges, false);
+    gr->AddEdges(rrDepEdges, false);
+}
+
+namespace CaseIO {
+    static inline bool IsSpace(char c) {
+        return c == ' ' || c == '\t' || c == '\r' || c == '\v' || c == '\f';
+    }
+
+    bool IsBinary(const char * data, size_t size) {
+        return size >= sizeof(CASE_MAGIC) && memcmp(data, CASE_MAGIC, sizeof(CASE_MAGIC)) == 0;
+    }
+
+    bool ParseText(const char * data, size_t size, Case & out) {
+        const char * end = data + size;
+        bool rrDep = false;
+        for (const char * p = data; p < end; ) {
+            const char * eol = (const char *)memchr(p, '\n', end - p);
+            if (eol == nullptr) eol = end;
+            const char * next = eol + 1;
+
+            if (*p == '#') {
+                if (eol - p >= 7 && memcmp(p, "# RRDEP", 7) == 0) rrDep = true;
+                p = next;
+                continue;
+            }
+
+            // "src dst dir", anything after is ignored
+            string tok[2];
+            int n = 0;
+            while (n < 2) {
+                while (p < eol && IsSpace(*p)) ++p;
+                const char * b = p;
+                while (p < eol && !IsSpace(*p)) ++p;
+                if (b == p) break;
+                tok[n++].assign(b, p);
+            }
+            while (p < eol && IsSpace(*p)) ++p;
+            if (p < eol && (*p == '-' || *p == '+')) ++p;
+            bool hasDir = p < eol && *p >= '0' && *p <= '9';
+            bool nonZero = false;
+            for (; p < eol && *p >= '0' && *p <= '9'; ++p) {
+                nonZero = nonZero || *p != '0';
+            }
+
+            if (n == 2 && hasDir) {
+                out.AddEdge(tok[0], tok[1], nonZero, rrDep);
+            }
+            p = next;
+        }
+        return true;
+    }
+
+    bool ParseBinary(const char * data, size_t size, Case & out) {
+        if (!IsBinary(data, size)) return false;
+        size_t words = (size - sizeof(CASE_MAGIC)) / sizeof(uint32_t);
+        const uint32_t * w = (const uint32_t *)(data + sizeof(CASE_MAGIC));
+        if (words < 1 || w[0] < 1 || w[0] > CASE_VERSION) return false;
+        int kinds = w[0] == 1 ? 3 : 4;
+        size_t headerWords = 3 + kinds + 1;
+        if (words < headerWords) return false;
+
+        uint64_t n = w[1];
+        uint64_t threadCount = w[2];
+        uint64_t counts[4] = { 0, 0, 0, 0 };
+        copy(w + 3, w + 3 + kinds, counts);
+        uint64_t nameBytes = w[3 + kinds];
+        uint64_t arrayWords = n + 2 * (counts[0] + counts[1] + counts[2] + counts[3]) + n;
+        if (words - headerWords < arrayWords) return false;
+        const uint32_t * p = w + headerWords;
+        const char * names = (const char *)(p + arrayWords);
+        if ((size_t)(data + size - names) < nameBytes) return false;
+
+        out = Case();
+        out.threadCount = threadCount;
+        out.threadIds.assign(p, p + n);
+        for (auto t : out.threadIds) {
+            if ((uint64_t)t >= threadCount) return false;
+        }
+        p += n;
+
+        vector<pair<int, int>> * edges[4] = { &out.poEdges, &out.depEdges, &out.rrDepEdges, &out.rrPoEdges };
+        for (int k = 0; k < kinds; ++k) {
+            edges[k]->reserve(counts[k]);
+            for (uint64_t i = 0; i < counts[k]; ++i, p += 2) {
+                if (p[0] >= n || p[1] >= n) return false;
+                edges[k]->push_back(make_pair((int)p[0], (int)p[1]));
+            }
+        }
+
+        out.names.resize(n);
+        uint32_t begin = 0;
+        for (uint64_t i = 0; i < n; ++i) {
+            if (p[i] < begin || p[i] > nameBytes) return false;
+            out.names[i].assign(names + begin, names + p[i]);
+            out.nameToId[out.names[i]] = i;
+            begin = p[i];
+        }
+        return true;
+    }
+
+    bool Read(int fd, Case & out) {
+        struct stat st;
+        if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+            size_t size = st.st_size;
+            void * map = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (map != MAP_FAILED) {
+                const char * data = (const char *)map;
+                bool ok = IsBinary(data, size)
+                    ? ParseBinary(data, size, out)
+                    : ParseText(data, size, out);
+                munmap(map, size);
+                return ok;
+            }
+        }
+
+        // pipes and the like
+        vector<char> buf;
+        char chunk[1 << 16];
+        ssize_t r;
+        while ((r = read(fd, chunk, sizeof(chunk))) > 0) {
+            buf.insert(buf.end(), chunk, chunk + r);
+        }
+        if (r < 0) return false;
+        return IsBinary(buf.data(), buf.size())
+            ? ParseBinary(buf.data(), buf.size(), out)
+            : ParseText(buf.data(), buf.size(), out);
+    }
+
+    bool WriteBinary(ostream & out, const Case & c) {
+        vector<uint32_t> w;
+        w.push_back(CASE_VERSION);
+        w.push_back(c.names.size());
+        w.push_back(c.threadCount);
+        w.push_back(c.poEdges.size());
+        w.push_back(c.depEdges.size());
+        w.push_back(c.rrDepEdges.size());
+        w.push_back(c.rrPoEdges.size());
+        size_t nameBytes = 0;
+        for (auto && s : c.names) {
+            nameBytes += s.size();
+        }
+        w.push_back(nameBytes);
+
+        w.insert(w.end(), c.threadIds.begin(), c.threadIds.end());
+        for (auto edges : { &c.poEdges, &c.depEdges, &c.rrDepEdges, &c.rrPoEdges }) {
+            for (auto && e : *edges) {
+                w.push_back(e.first);
+                w.push_back(e.second);
+            }
+        }
+        uint32_t offset = 0;
+        for (auto && s : c.names) {
+            offset += s.size();
+            w.push_back(offset);
+        }
+
+        out.write(CASE_MAGIC, sizeof(CASE_MAGIC));
+        out.write((const char *)w.data(), w.size() * sizeof(uint32_t));
+        for (auto && s : c.names) {
+            out.write(s.data(), s.size());
+        }
+        return !!out;
+    }
+}
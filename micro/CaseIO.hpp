@@ -0,0 +1,62 @@
+#ifndef __CASE_IO_HPP__
+#define __CASE_IO_HPP__
+
+#include "Base.hpp"
+#include <cstdint>
+#include <iostream>
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+
+// A benchmark case as DataGen writes it and Calc reads it: named vertices,
+// program order edges, dependencies, and the edges of the read-read section
+// that only the graph sampled by RPOS gets.
+//
+// Vertex ids follow the first appearance of the names in the text format,
+// and the thread of a vertex is the part of its name before the first '_',
+// as in the "<thread>_<id>" names of DataGen, or the first character of
+// names without one, as in examples/. Threads are numbered in order of
+// vertex id. Edges keep their order within each kind, which is
+// all the frozen graph depends on.
+struct Case {
+    std::vector<std::string> names; // by vertex id
+    std::vector<int> threadIds;     // by vertex id
+    int threadCount;
+    std::vector<std::pair<int, int>> poEdges;
+    std::vector<std::pair<int, int>> depEdges;
+    std::vector<std::pair<int, int>> rrDepEdges;
+    std::vector<std::pair<int, int>> rrPoEdges; // directed lines after "# RRDEP"
+    std::map<std::string, int> nameToId;
+    std::map<std::string, int> threadOfName;
+
+    Case() : threadCount(0) { }
+
+    // Adds the edge of one text line, creating its vertices on first sight
+    void AddEdge(const std::string & src, const std::string & dst, bool directed, bool rrDep);
+
+    // Adds the edges to g, and to gr along with the edges of the read-read
+    // section. Both graphs must be empty and get the same vertex ids.
+    void Build(Graph * g, Graph * gr) const;
+};
+
+// The text format has one "src dst 1|0" line per directed or undirected
+// edge, with the read-read dependencies after a "# RRDEP" line; other
+// lines starting with '#' are comments and lines that do not parse are
+// skipped. The binary format is versioned and holds the same data in
+// packed 32-bit arrays, read in place from a single mapping of the file.
+namespace CaseIO {
+    // Whether the bytes start like a binary case
+    bool IsBinary(const char * data, size_t size);
+
+    bool ParseText(const char * data, size_t size, Case & out);
+    bool ParseBinary(const char * data, size_t size, Case & out);
+
+    // Reads a case in either format from a file descriptor, mapping it
+    // when it is a regular file and reading it through otherwise
+    bool Read(int fd, Case & out);
+
+    bool WriteBinary(std::ostream & out, const Case & c);
+}
+
+#endif
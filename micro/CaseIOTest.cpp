@@ -0,0 +1,112 @@
+#include "CaseIO.hpp"
+#include <cstring>
+#include <iostream>
+#include <sstream>
+
+using namespace std;
+
+// Checks the text and binary case readers; exits with 1 on the first
+// failed check, in any build type
+#define CHECK(cond) do {                                                \
+        if (!(cond)) {                                                  \
+            cerr << __FILE__ << ':' << __LINE__ << ": " #cond << endl;  \
+            return false;                                               \
+        }                                                               \
+    } while (0)
+
+static const char * TEXT =
+    "# a comment\n"
+    "a1 a2 1\n"
+    "a1 b1 0\n"
+    "# RRDEP\n"
+    "a2 b1 0\n"
+    "b1 b2 1\n";
+
+typedef pair<int, int> IdPair;
+
+// Whether g has an edge from -> to, and whether it is directed
+static bool FindEdge(Graph & g, int from, int to, bool & directed) {
+    for (auto e : g.vertices[from]->outEdges) {
+        if (e->to->id == to) {
+            directed = e->IsDirected();
+            return true;
+        }
+    }
+    return false;
+}
+
+// The case of TEXT, read back from either format
+static bool CheckCase(const Case & c) {
+    CHECK(c.names.size() == 4);
+    int a1 = c.nameToId.at("a1"), a2 = c.nameToId.at("a2");
+    int b1 = c.nameToId.at("b1"), b2 = c.nameToId.at("b2");
+    CHECK(c.threadCount == 2);
+    CHECK(c.threadIds[a1] == c.threadIds[a2] && c.threadIds[b1] == c.threadIds[b2]);
+    CHECK(c.threadIds[a1] != c.threadIds[b1]);
+
+    CHECK(c.poEdges == vector<IdPair>(1, IdPair(a1, a2)));
+    CHECK(c.depEdges == vector<IdPair>(1, IdPair(a1, b1)));
+    CHECK(c.rrDepEdges == vector<IdPair>(1, IdPair(a2, b1)));
+    CHECK(c.rrPoEdges == vector<IdPair>(1, IdPair(b1, b2)));
+
+    // the directed line of the read-read section stays directed, in gr only
+    Graph g, gr;
+    c.Build(&g, &gr);
+    bool directed = false;
+    CHECK(!FindEdge(g, b1, b2, directed));
+    CHECK(FindEdge(gr, b1, b2, directed) && directed);
+    CHECK(!FindEdge(gr, b2, b1, directed));
+    CHECK(!FindEdge(g, a2, b1, directed));
+    CHECK(FindEdge(gr, a2, b1, directed) && !directed);
+    CHECK(FindEdge(gr, a1, a2, directed) && directed);
+    CHECK(FindEdge(g, a1, b1, directed) && !directed);
+    return true;
+}
+
+static bool TestText() {
+    Case c;
+    CHECK(!CaseIO::IsBinary(TEXT, strlen(TEXT)));
+    CHECK(CaseIO::ParseText(TEXT, strlen(TEXT), c));
+    return CheckCase(c);
+}
+
+static bool TestBinaryRoundTrip() {
+    Case c;
+    CHECK(CaseIO::ParseText(TEXT, strlen(TEXT), c));
+    ostringstream out;
+    CHECK(CaseIO::WriteBinary(out, c));
+    string bytes = out.str();
+    CHECK(CaseIO::IsBinary(bytes.data(), bytes.size()));
+
+    Case back;
+    CHECK(CaseIO::ParseBinary(bytes.data(), bytes.size(), back));
+    CHECK(back.names == c.names);
+    CHECK(CheckCase(back));
+
+    // a truncated file is rejected
+    CHECK(!CaseIO::ParseBinary(bytes.data(), bytes.size() - 1, back));
+    return true;
+}
+
+// DataGen names vertices "<thread>_<id>", with any number of threads
+static bool TestThreadNames() {
+    const char * text =
+        "1_0 1_2 1\n"
+        "10_1 1_0 0\n"
+        "11_3 10_1 0\n";
+    Case c;
+    CHECK(CaseIO::ParseText(text, strlen(text), c));
+    CHECK(c.threadCount == 3);
+    CHECK(c.threadIds[c.nameToId.at("1_0")] == c.threadIds[c.nameToId.at("1_2")]);
+    CHECK(c.threadIds[c.nameToId.at("1_0")] != c.threadIds[c.nameToId.at("10_1")]);
+    CHECK(c.threadIds[c.nameToId.at("10_1")] != c.threadIds[c.nameToId.at("11_3")]);
+    return true;
+}
+
+int main() {
+    bool ok = TestText();
+    ok = TestThreadNames() && ok;
+    ok = TestBinaryRoundTrip() && ok;
+    cout << (ok ? "OK" : "FAILED") << endl;
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,364 @@
+#include "Counting.hpp"
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+#include <set>
+
+using namespace std;
+
+BigUInt::BigUInt(uint64_t v) {
+    while (v > 0) {
+        _limbs.push_back((uint32_t)v);
+        v >>= 32;
+    }
+}
+
+BigUInt::BigUInt(const vector<uint32_t> & limbs) : _limbs(limbs) {
+    while (!_limbs.empty() && _limbs.back() == 0) _limbs.pop_back();
+}
+
+BigUInt & BigUInt::operator+=(const BigUInt & o) {
+    if (_limbs.size() < o._limbs.size()) {
+        _limbs.resize(o._limbs.size(), 0);
+    }
+    uint64_t carry = 0;
+    for (size_t i = 0; i < _limbs.size(); ++i) {
+        if (i >= o._limbs.size() && carry == 0) break;
+        uint64_t s = (uint64_t)_limbs[i] + carry + (i < o._limbs.size() ? o._limbs[i] : 0);
+        _limbs[i] = (uint32_t)s;
+        carry = s >> 32;
+    }
+    if (carry > 0) {
+        _limbs.push_back((uint32_t)carry);
+    }
+    return *this;
+}
+
+uint64_t BigUInt::Saturated() const {
+    if (_limbs.size() > 2) return UINT64_MAX;
+    uint64_t r = 0;
+    for (size_t i = _limbs.size(); i > 0; --i) {
+        r = (r << 32) | _limbs[i - 1];
+    }
+    return r;
+}
+
+double BigUInt::ToDouble() const {
+    double r = 0;
+    for (size_t i = _limbs.size(); i > 0; --i) {
+        r = r * 4294967296.0 + _limbs[i - 1];
+    }
+    return r;
+}
+
+string BigUInt::ToString() const {
+    if (_limbs.empty()) return "0";
+
+    // repeated division by 10^9
+    vector<uint32_t> q(_limbs);
+    vector<uint32_t> chunks;
+    while (!q.empty()) {
+        uint64_t rem = 0;
+        for (size_t i = q.size(); i > 0; --i) {
+            uint64_t cur = (rem << 32) | q[i - 1];
+            q[i - 1] = (uint32_t)(cur / 1000000000);
+            rem = cur % 1000000000;
+        }
+        chunks.push_back((uint32_t)rem);
+        while (!q.empty() && q.back() == 0) q.pop_back();
+    }
+
+    string r = to_string(chunks.back());
+    for (size_t i = chunks.size() - 1; i > 0; --i) {
+        string c = to_string(chunks[i - 1]);
+        r.append(9 - c.size(), '0');
+        r += c;
+    }
+    return r;
+}
+
+namespace Counting {
+    static inline uint64_t Mix64(uint64_t x) {
+        x ^= x >> 30;
+        x *= 0xbf58476d1ce4e5b9ull;
+        x ^= x >> 27;
+        x *= 0x94d049bb133111ebull;
+        x ^= x >> 31;
+        return x;
+    }
+
+    // Memo keyed by fixed-width bitset states. Keys are stored back to back
+    // and found through an open addressing table of indices.
+    template <typename T>
+    class StateTable {
+        int _words;
+        vector<uint64_t> _keys;
+        vector<T> _values;
+        vector<int> _slots; // index into _values, -1 if empty
+
+        inline uint64_t Hash(const uint64_t * key) const {
+            uint64_t h = 0x9e3779b97f4a7c15ull;
+            for (int i = 0; i < _words; ++i) {
+                h = Mix64(h + key[i]);
+            }
+            return h;
+        }
+
+        void Grow() {
+            vector<int> old(_slots.size() * 2, -1);
+            old.swap(_slots);
+            size_t mask = _slots.size() - 1;
+            for (int idx : old) {
+                if (idx < 0) continue;
+                size_t i = Hash(_keys.data() + (size_t)idx * _words) & mask;
+                while (_slots[i] >= 0) {
+                    i = (i + 1) & mask;
+                }
+                _slots[i] = idx;
+            }
+        }
+
+    public:
+        explicit StateTable(int words) : _words(words), _slots(1024, -1) { }
+
+        // Returns the memoized value of key, or nullptr
+        const T * Find(const uint64_t * key) const {
+            size_t mask = _slots.size() - 1;
+            for (size_t i = Hash(key) & mask; _slots[i] >= 0; i = (i + 1) & mask) {
+                const uint64_t * k = _keys.data() + (size_t)_slots[i] * _words;
+                if (memcmp(k, key, _words * sizeof(uint64_t)) == 0) {
+                    return &_values[_slots[i]];
+                }
+            }
+            return nullptr;
+        }
+
+        void Insert(const uint64_t * key, const T & value) {
+            if (2 * (_values.size() + 1) > _slots.size()) {
+                Grow();
+            }
+            size_t mask = _slots.size() - 1;
+            size_t i = Hash(key) & mask;
+            while (_slots[i] >= 0) {
+                i = (i + 1) & mask;
+            }
+            _slots[i] = _values.size();
+            _keys.insert(_keys.end(), key, key + _words);
+            _values.push_back(value);
+        }
+    };
+
+    // Depth-first evaluation of the DP. The state is the downset bitset,
+    // followed by the sleep set bitset when counting traces.
+    class Counter {
+        TopoWalk _walk;
+        int _words;
+        bool _fSleepSet;
+        vector<uint64_t> _state;
+        StateTable<BigUInt> _memo;
+
+        inline bool Test(int part, int v) const {
+            return (_state[part * _words + v / 64] >> (v % 64)) & 1;
+        }
+
+        inline void Flip(int part, int v) {
+            _state[part * _words + v / 64] ^= 1ULL << (v % 64);
+        }
+
+    public:
+        Counter(const CsrGraph & csr, bool sleepSet)
+            : _walk(csr), _words((csr.Size() + 63) / 64), _fSleepSet(sleepSet),
+              _state((sleepSet ? 2 : 1) * _words, 0), _memo((sleepSet ? 2 : 1) * _words) { }
+
+        BigUInt Count() {
+            if (_walk.Done()) return BigUInt(1);
+
+            const BigUInt * memo = _memo.Find(_state.data());
+            if (memo != nullptr) return *memo;
+
+            const CsrGraph & csr = _walk.GetGraph();
+            vector<int> frontier(_walk.Frontier());
+            // entry sleep set, then the one of the next child before the
+            // dependencies of the child wake up
+            vector<uint64_t> entry, sleep;
+            if (_fSleepSet) {
+                entry.assign(_state.begin() + _words, _state.end());
+                sleep = entry;
+            }
+
+            BigUInt total;
+            for (int v : frontier) {
+                if (_fSleepSet) {
+                    if ((sleep[v / 64] >> (v % 64)) & 1) continue;
+                    copy(sleep.begin(), sleep.end(), _state.begin() + _words);
+                    for (auto d = csr.DepBegin(v); d != csr.DepEnd(v); ++d) {
+                        if (Test(1, *d)) Flip(1, *d);
+                    }
+                }
+
+                Flip(0, v);
+                _walk.Schedule(v);
+                total += Count();
+                _walk.Unschedule(v);
+                Flip(0, v);
+
+                if (_fSleepSet) {
+                    sleep[v / 64] |= 1ULL << (v % 64);
+                }
+            }
+
+            if (_fSleepSet) {
+                copy(entry.begin(), entry.end(), _state.begin() + _words);
+            }
+
+            _memo.Insert(_state.data(), total);
+            return total;
+        }
+    };
+
+    // DP over the downsets of one class. The class is the partial order of
+    // its representative: directed edges plus every dependency oriented as
+    // in the representative. A step may take any vertex the class has made
+    // minimal; the random walk picks among all that the program enables.
+    class ClassAnalyzer {
+        struct Entry {
+            double rw;
+            BigUInt orders;
+        };
+
+        TopoWalk _walk;
+        int _words;
+        vector<int> _tracePredCount; // unscheduled predecessors in the class
+        vector<int> _traceSuccStart;
+        vector<int> _traceSucc;
+        vector<uint64_t> _state; // downset, then last vertex + 1 for preemptions
+        StateTable<Entry> _memo;
+        StateTable<int> _preemptionMemo;
+        set<pair<int, int>> _races;
+
+        inline void Schedule(int v) {
+            _state[v / 64] ^= 1ULL << (v % 64);
+            _walk.Schedule(v);
+            for (int i = _traceSuccStart[v]; i < _traceSuccStart[v + 1]; ++i) {
+                --_tracePredCount[_traceSucc[i]];
+            }
+        }
+
+        inline void Unschedule(int v) {
+            for (int i = _traceSuccStart[v]; i < _traceSuccStart[v + 1]; ++i) {
+                ++_tracePredCount[_traceSucc[i]];
+            }
+            _walk.Unschedule(v);
+            _state[v / 64] ^= 1ULL << (v % 64);
+        }
+
+        Entry Visit() {
+            if (_walk.Done()) return Entry{ 1, BigUInt(1) };
+
+            const Entry * memo = _memo.Find(_state.data());
+            if (memo != nullptr) return *memo;
+
+            const CsrGraph & csr = _walk.GetGraph();
+            vector<int> frontier(_walk.Frontier());
+            Entry r{ 0, BigUInt() };
+            for (int v : frontier) {
+                if (_tracePredCount[v] > 0) continue;
+                Schedule(v);
+                for (auto d = csr.DepBegin(v); d != csr.DepEnd(v); ++d) {
+                    if (_walk.InFrontier(*d)) _races.insert(make_pair(v, *d));
+                }
+                Entry child = Visit();
+                Unschedule(v);
+                r.rw += child.rw / frontier.size();
+                r.orders += child.orders;
+            }
+
+            _memo.Insert(_state.data(), r);
+            return r;
+        }
+
+        // Fewest preemptions to finish when `last` was scheduled last: steps
+        // that skip every vertex the previous step enabled
+        int VisitPreemption(int last) {
+            if (_walk.Done()) return 0;
+
+            _state[_words] = last + 1;
+            const int * memo = _preemptionMemo.Find(_state.data());
+            if (memo != nullptr) return *memo;
+
+            const CsrGraph & csr = _walk.GetGraph();
+            vector<int> frontier(_walk.Frontier());
+            vector<int> fresh;
+            if (last >= 0) {
+                for (auto s = csr.SuccBegin(last); s != csr.SuccEnd(last); ++s) {
+                    if (_walk.InFrontier(*s)) fresh.push_back(*s);
+                }
+            }
+
+            int best = -1;
+            for (int v : frontier) {
+                if (_tracePredCount[v] > 0) continue;
+                int cost = fresh.size() > 0 && find(fresh.begin(), fresh.end(), v) == fresh.end();
+                Schedule(v);
+                cost += VisitPreemption(v);
+                Unschedule(v);
+                if (best < 0 || cost < best) best = cost;
+            }
+
+            _state[_words] = last + 1;
+            _preemptionMemo.Insert(_state.data(), best);
+            return best;
+        }
+
+    public:
+        ClassAnalyzer(const CsrGraph & csr, const vector<int> & order)
+            : _walk(csr), _words((csr.Size() + 63) / 64),
+              _state(_words + 1, 0), _memo(_words), _preemptionMemo(_words + 1) {
+            int n = csr.Size();
+            vector<int> pos(n);
+            for (int i = 0; i < n; ++i) {
+                pos[order[i]] = i;
+            }
+
+            _tracePredCount.assign(n, 0);
+            _traceSuccStart.assign(n + 1, 0);
+            for (int v = 0; v < n; ++v) {
+                for (auto s = csr.SuccBegin(v); s != csr.SuccEnd(v); ++s) {
+                    _traceSucc.push_back(*s);
+                    ++_tracePredCount[*s];
+                }
+                for (auto d = csr.DepBegin(v); d != csr.DepEnd(v); ++d) {
+                    if (pos[*d] > pos[v]) {
+                        _traceSucc.push_back(*d);
+                        ++_tracePredCount[*d];
+                    }
+                }
+                _traceSuccStart[v + 1] = _traceSucc.size();
+            }
+        }
+
+        void Run(ClassStats & out) {
+            Entry r = Visit();
+            out.rw = r.rw;
+            out.orders = r.orders;
+            out.races.assign(_races.begin(), _races.end());
+            out.minPreemption = VisitPreemption(-1);
+        }
+    };
+
+    void AnalyzeClass(const CsrGraph & g, const vector<int> & order, ClassStats & out) {
+        assert(order.size() == g.Size());
+        ClassAnalyzer a(g, order);
+        a.Run(out);
+    }
+
+    BigUInt CountOrders(Graph * g) {
+        Counter c(g->Freeze(), false);
+        return c.Count();
+    }
+
+    BigUInt CountTraces(Graph * g) {
+        Counter c(g->Freeze(), true);
+        return c.Count();
+    }
+}
@@ -0,0 +1,59 @@
+#ifndef __COUNTING_HPP__
+#define __COUNTING_HPP__
+
+#include "Base.hpp"
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+// Unsigned integer of arbitrary size, enough for the number of orders of a
+// program. Only what counting needs: addition and printing.
+class BigUInt {
+    std::vector<uint32_t> _limbs; // least significant first, no leading zeros
+
+public:
+    BigUInt(uint64_t v = 0);
+    // From least significant first 32-bit limbs, as returned by Limbs()
+    explicit BigUInt(const std::vector<uint32_t> & limbs);
+
+    BigUInt & operator+=(const BigUInt & o);
+    inline bool operator==(const BigUInt & o) const { return _limbs == o._limbs; }
+    inline bool operator!=(const BigUInt & o) const { return _limbs != o._limbs; }
+    inline bool IsZero() const { return _limbs.empty(); }
+    inline const std::vector<uint32_t> & Limbs() const { return _limbs; }
+
+    // The value, or UINT64_MAX if it does not fit
+    uint64_t Saturated() const;
+    double ToDouble() const;
+    std::string ToString() const;
+};
+
+// Exact counts by dynamic programming over downsets, without enumerating
+// the orders. A downset is a set of scheduled vertices closed under directed
+// predecessors; the number of ways to finish from one depends only on it
+// (and, for traces, on the sleep set there), so each state is solved once
+// and memoized in a table keyed by its bitsets.
+namespace Counting {
+    // Total orders respecting the directed edges
+    BigUInt CountOrders(Graph * g);
+    // Partial order classes: the leaves of the sleep-set DFS, memoized on
+    // (downset, sleep set)
+    BigUInt CountTraces(Graph * g);
+
+    // Exact ground truth of one partial order class, given by any of its
+    // orders, without enumerating the others
+    struct ClassStats {
+        BigUInt orders;
+        // probability that the random walk ends in the class: the sum over
+        // its orders of the product of 1 / frontier size at every step
+        double rw;
+        int minPreemption;
+        // (v, d) such that d depends on v and is enabled right after v, in
+        // some order of the class; sorted
+        std::vector<std::pair<int, int>> races;
+    };
+    void AnalyzeClass(const CsrGraph & g, const std::vector<int> & order, ClassStats & out);
+}
+
+#endif
@@ -2,6 +2,8 @@
 #include "Generators.hpp"
 #include "Schedulers.hpp"
 #include "PorStat.hpp"
+#include "Counting.hpp"
+#include "CaseIO.hpp"
 #include <cassert>
 #include <iostream>
 #include <string>
@@ -57,12 +59,24 @@ int main(int argc, char ** argv) {
         seed = rd();
     }
 
-    cout << "# opts:" << endl;
+    // "text" or "binary" (CaseIO.hpp); binary cases have no comments, so
+    // they go to stderr instead
+    bool binary = false;
+    if (opts.find("format") != opts.end()) {
+        if (opts["format"] == "binary") binary = true;
+        else if (opts["format"] != "text") {
+            cerr << "Unknown format " << opts["format"] << endl;
+            return 1;
+        }
+    }
+    ostream & info = binary ? cerr : cout;
+
+    info << "# opts:" << endl;
     for (auto && kv : opts) {
-        cout << "#   " << get<0>(kv) << ':' << get<1>(kv) << endl;
+        info << "#   " << get<0>(kv) << ':' << get<1>(kv) << endl;
     }
 
-    cout << "# seed: " << seed << endl;
+    info << "# seed: " << seed << endl;
     random.seed(seed);
 
     if (opts.find("name") != opts.end()) {
@@ -140,8 +154,32 @@ int main(int argc, char ** argv) {
             }
         }
     }
+    else if (name == "random-dag") {
+        int width = 4;
+        int depth = 4;
+        double density = 0.3;
+        int sinks = 1;
+        if (opts.find("rd.width") != opts.end()) {
+            width = stoi(opts["rd.width"]);
+        }
+        if (opts.find("rd.depth") != opts.end()) {
+            depth = stoi(opts["rd.depth"]);
+        }
+        if (opts.find("rd.density") != opts.end()) {
+            density = stod(opts["rd.density"]);
+        }
+        if (opts.find("rd.sinks") != opts.end()) {
+            sinks = stoi(opts["rd.sinks"]);
+        }
+        vector<int> ids;
+        RandomDag(g, random, width, depth, density, sinks, ids);
+
+        for (auto v : g->vertices) {
+            threadId[v] = ids[v->id];
+        }
+    }
 
-    if (name == "anti-chain" || name == "rainbow" || name == "double-tree") {
+    if (name == "anti-chain" || name == "rainbow" || name == "double-tree" || name == "random-dag") {
         string depName = "uniform";
 
         if (opts.find("dep-name") != opts.end()) {
@@ -205,9 +243,18 @@ int main(int argc, char ** argv) {
         }
     }
 
-    {
+    if (opts.find("explorer") == opts.end()) {
+        // counted on downsets without enumerating the classes
+        info << "# por count: " << Counting::CountTraces(g).ToString() << endl;
+    }
+    else {
         porTree = new PorTree(g);
-        auto e = Systematic::CreateDfsExplorer();
+        // both explorers visit one order per class; "odpor" skips the
+        // sleep-set blocked paths of the DFS
+        bool optimal = opts["explorer"] == "odpor";
+        auto e = optimal
+            ? Systematic::CreateOptimalDporExplorer()
+            : Systematic::CreateDfsExplorer();
         e->Begin(g);
         vector<Vertex *> order;
         while (true) {
@@ -228,7 +275,7 @@ int main(int argc, char ** argv) {
             assert(porTree->GetRoot()->minHit == 1);
         }
         e->End();
-        cout << "# por count: " << porTree->GetRoot()->size << endl;
+        info << "# por count: " << porTree->GetRoot()->size << endl;
         delete porTree;
     }
 
@@ -236,34 +283,42 @@ int main(int argc, char ** argv) {
         assert(threadId.find(v) != threadId.end());
     }
 
+    // one text line per edge, or the same edges in the same order added to
+    // a binary case
+    Case output;
+    auto emit = [&](Vertex * a, Vertex * b, bool directed, bool rrDep) {
+        if (binary) {
+            output.AddEdge(to_string(threadId[a]) + '_' + to_string(a->id),
+                           to_string(threadId[b]) + '_' + to_string(b->id), directed, rrDep);
+        }
+        else {
+            cout << threadId[a] << '_' << a->id << ' ' << threadId[b] << '_' << b->id << (directed ? " 1" : " 0") << endl;
+        }
+    };
+
     for (auto v : g->vertices) {
         for (auto e : v->outEdges) {
             if (e->IsDirected()) {
-                cout << threadId[v] << '_' << v->id << ' ' << threadId[e->to] << '_' << e->to->id << " 1" << endl;
+                emit(v, e->to, true, false);
             }
             else if (v->id < e->to->id) {
-                cout << threadId[v] << '_' << v->id << ' ' << threadId[e->to] << '_' << e->to->id << " 0" << endl;
+                emit(v, e->to, false, false);
             }
         }
     }
 
-    {
-        bool first = true;
-        for (auto v1 : g->vertices) {
-            for (auto v2 : g->vertices) {
-                if (v1->id < v2->id &&
-                    rwInfo.find(v1->id) != end(rwInfo) &&
-                    rwInfo.find(v2->id) != end(rwInfo) &&
-                    get<0>(rwInfo[v1->id]) == get<0>(rwInfo[v2->id]) &&
-                    !get<1>(rwInfo[v1->id]) && !get<1>(rwInfo[v2->id])) {
-                    if (first) {
-                        first = false;
-                        cout << "# RRDEP" << endl;
-                    }
-                    cout << threadId[v1] << '_' << v1->id << ' ' << threadId[v2] << '_' << v2->id << " 0" << endl;
-                }
-            }
-        }
+    vector<pair<int, int>> rrDeps;
+    ReadReadDependencies(rwInfo, rrDeps);
+    if (rrDeps.size() > 0 && !binary) {
+        cout << "# RRDEP" << endl;
+    }
+    for (auto && p : rrDeps) {
+        emit(g->vertices[p.first], g->vertices[p.second], false, true);
+    }
+
+    if (binary && !CaseIO::WriteBinary(cout, output)) {
+        cerr << "Cannot write the case" << endl;
+        return 1;
     }
 
     return 0;
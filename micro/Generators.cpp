@@ -9,18 +9,20 @@ using namespace std;
 namespace Generator {
 
     void RainbowSkeleton(Graph * g, int width, int length) {
+        vector<pair<int, int>> po;
         for (int i = 0; i < width; ++i) {
             vector<Vertex *> chain;
             for (int j = 0; j < length; ++j) {
                 auto v = g->NewVertex();
 
                 if (chain.size() > 0) {
-                    g->AddDirectedEdge(chain.back(), v);
+                    po.push_back(make_pair(chain.back()->id, v->id));
                 }
 
                 chain.push_back(v);
             }
         }
+        g->AddEdges(po, true);
     }
 
     static tuple<Vertex *, Vertex *> ConstructSubDoubleTree(Graph * g, int depth) {
@@ -62,24 +64,48 @@ namespace Generator {
 
     void AddUniformPairDependency(Graph * g, random_engine & random, double density) {
         uniform_real_distribution<double> dist(0.0, 1.0);
+        vector<pair<int, int>> deps;
 
         for (int i = 0; i < g->vertices.size(); ++i) {
             for (int j = i + 1; j < g->vertices.size(); ++j) {
                 if (dist(random) < density) {
-                    g->AddUndirectedEdge(g->vertices[i], g->vertices[j]);
+                    deps.push_back(make_pair(i, j));
                 }
             }
         }
+        g->AddEdges(deps, false);
+    }
+
+    // Earlier accesses to one object, in vertex order
+    struct ObjectAccesses {
+        vector<int> all;
+        vector<int> writers;
+    };
+
+    // Records that vertex i accesses the object of `a`, after the conflicts
+    // with the earlier accesses: all of them for a write, the writes for a
+    // read. The pairs come in the order an all-pairs scan over j < i finds
+    // them.
+    static void AddAccess(ObjectAccesses & a, int i, bool isWrite, vector<pair<int, int>> & deps) {
+        for (int j : isWrite ? a.all : a.writers) {
+            deps.push_back(make_pair(i, j));
+        }
+        a.all.push_back(i);
+        if (isWrite) a.writers.push_back(i);
     }
 
     void AddRWDependency(Graph * g, random_engine & random, double idleRatio, double rwRatio, double skew, int total, map<int, tuple<int, bool>> & rwInfo) {
         uniform_real_distribution<double> dist(0.0, 1.0);
+        vector<pair<int, int>> deps;
+        vector<ObjectAccesses> objects(total);
         rwInfo.clear();
 
         for (int i = 0; i < g->vertices.size(); ++i) {
             int id;
 
             if (dist(random) <= idleRatio) {
+                // idle vertices read the object `total`, which no other
+                // vertex accesses
                 rwInfo[i] = make_tuple(total, false);
                 continue;
             }
@@ -99,16 +125,10 @@ namespace Generator {
                 id = udist(random);
             }
 
-            for (int j = 0; j < i; ++j) {
-                if (get<0>(rwInfo[j]) == id) {
-                    if (get<1>(rwInfo[j]) || isWrite) {
-                        g->AddUndirectedEdge(g->vertices[i], g->vertices[j]);
-                    }
-                }
-            }
-
+            AddAccess(objects[id], i, isWrite, deps);
             rwInfo[i] = make_tuple(id, isWrite);
         }
+        g->AddEdges(deps, false);
 
         // bool first = true;
         // for (auto && kv : rwInfo) {
@@ -122,6 +142,7 @@ namespace Generator {
     void AddRWDistDependency(Graph * g, random_engine & random, const vector<int> & rwDist, map<int, tuple<int, bool>> & rwInfo) {
         rwInfo.clear();
         vector<tuple<int, bool>> pool;
+        vector<pair<int, int>> deps;
 
         for (int i = 0; i < rwDist.size(); ++i) {
             int objId = i / 2;
@@ -135,75 +156,172 @@ namespace Generator {
 
         shuffle(begin(pool), end(pool), random);
 
+        vector<ObjectAccesses> objects((rwDist.size() + 1) / 2);
         for (int i = 0; i < g->vertices.size(); ++i) {
             rwInfo[i] = pool[i];
+            AddAccess(objects[get<0>(pool[i])], i, get<1>(pool[i]), deps);
+        }
+        g->AddEdges(deps, false);
+    }
 
-            for (int j = 0; j < i; ++j) {
-                if (get<0>(rwInfo[i]) == get<0>(rwInfo[j]) &&
-                    (get<1>(rwInfo[i]) || get<1>(rwInfo[j]))) {
-                    g->AddUndirectedEdge(g->vertices[i], g->vertices[j]);
-                }
+    void ReadReadDependencies(const map<int, tuple<int, bool>> & rwInfo, vector<pair<int, int>> & out) {
+        map<int, vector<int>> readers;
+        for (auto && kv : rwInfo) {
+            if (!get<1>(kv.second)) readers[get<0>(kv.second)].push_back(kv.first);
+        }
+
+        // every reader with the later readers of its object
+        map<int, size_t> seen;
+        for (auto && kv : rwInfo) {
+            if (get<1>(kv.second)) continue;
+            auto & r = readers[get<0>(kv.second)];
+            for (size_t k = ++seen[get<0>(kv.second)]; k < r.size(); ++k) {
+                out.push_back(make_pair(kv.first, r[k]));
             }
         }
     }
 
+#ifndef NDEBUG
+    // Union-find with path halving, iterative so that long chains cannot
+    // overflow the stack; only the spanning tree check below needs it
     static int DsFindRoot(vector<int> & d, int e) {
-        if (d[e] != e) {
-            return d[e] = DsFindRoot(d, d[e]);
-        }
-        else {
-            return e;
+        while (d[e] != e) {
+            d[e] = d[d[e]];
+            e = d[e];
         }
+        return e;
     }
 
     static void DsMerge(vector<int> & d, int a, int b) {
         d[DsFindRoot(d, a)] = DsFindRoot(d, b);
     }
 
-    void RandomTreeInternal(Graph * g, random_engine & random,
-                            const vector<Vertex *> & vertices,
-                            void(* funcAddEdge)(Graph *, Vertex *, Vertex *)) {
-        vector<int> dsParent;
-        int disjointParts = g->vertices.size();
-        dsParent.resize(g->vertices.size());
-
-        for (int i = 0; i < dsParent.size(); ++i) {
+    static bool IsSpanningTree(int n, const vector<pair<int, int>> & edges) {
+        if (edges.size() + 1 != (size_t)max(n, 1)) return false;
+        vector<int> dsParent(n);
+        for (int i = 0; i < n; ++i) {
             dsParent[i] = i;
         }
+        for (auto && e : edges) {
+            if (DsFindRoot(dsParent, e.first) == DsFindRoot(dsParent, e.second)) return false;
+            DsMerge(dsParent, e.first, e.second);
+        }
+        return true;
+    }
+#endif
 
-        vector<tuple<int, int>> edges;
-        for (int i = 0; i < dsParent.size(); ++i) {
-            for (int j = i + 1; j < dsParent.size(); ++j) {
-                edges.push_back(make_tuple(i, j));
+    // Uniform over the labeled trees on the vertices: decodes a uniformly
+    // random Pruefer sequence in linear time
+    void RandomTree(Graph * g, random_engine & random) {
+        int n = g->vertices.size();
+        vector<pair<int, int>> edges;
+        if (n >= 2) {
+            vector<int> code(n - 2);
+            uniform_int_distribution<int> d(0, n - 1);
+            for (auto & v : code) {
+                v = d(random);
             }
-        }
 
-        for (int i = 0; i < edges.size() - 1; ++i) {
-            uniform_int_distribution<int> d(i + 1, edges.size() - 1);
-            swap(edges[i], edges[d(random)]);
-        }
+            vector<int> degree(n, 1);
+            for (int v : code) {
+                ++degree[v];
+            }
 
-        for (int i = 0; i < edges.size(); ++i) {
-            int a = DsFindRoot(dsParent, get<0>(edges[i]));
-            int b = DsFindRoot(dsParent, get<1>(edges[i]));
-            if (a == b)
-                continue;
-            funcAddEdge(g, vertices[a], vertices[b]);
-            DsMerge(dsParent, a, b);
-            --disjointParts;
+            // smallest leaf not taken yet; a vertex that becomes a leaf below
+            // ptr is taken right away
+            int ptr = 0;
+            while (degree[ptr] != 1) ++ptr;
+            int leaf = ptr;
+            edges.reserve(n - 1);
+            for (int v : code) {
+                edges.push_back(make_pair(leaf, v));
+                if (--degree[v] == 1 && v < ptr) {
+                    leaf = v;
+                }
+                else {
+                    ++ptr;
+                    while (degree[ptr] != 1) ++ptr;
+                    leaf = ptr;
+                }
+            }
+            edges.push_back(make_pair(leaf, n - 1));
         }
 
-        assert(disjointParts == 1);
+        assert(IsSpanningTree(n, edges));
+        g->AddEdges(edges, false);
     }
 
-    void RandomTree(Graph * g, random_engine & random) {
-        RandomTreeInternal(g, random, g->vertices,
-                           [](Graph * g, Vertex * a, Vertex * b) {
-                               g->AddUndirectedEdge(a, b);
-                           });
+    void RandomDag(Graph * g, random_engine & random, int width, int depth, double density,
+                   int sinks) {
+        assert(width >= 1 && depth >= 1 && sinks >= 1);
+        uniform_real_distribution<double> dist(0.0, 1.0);
+        uniform_int_distribution<int> layerSize(1, width);
+
+        // layers of consecutive ids; the last one holds the sinks
+        vector<int> layerStart(1, g->vertices.size());
+        for (int l = 0; l < depth; ++l) {
+            int size = l == depth - 1 ? sinks : layerSize(random);
+            for (int i = 0; i < size; ++i) {
+                g->NewVertex();
+            }
+            layerStart.push_back(g->vertices.size());
+        }
+
+        vector<pair<int, int>> po;
+        vector<bool> hasParent(g->vertices.size(), false);
+        vector<bool> hasChild(g->vertices.size(), false);
+        for (int l = 1; l < depth; ++l) {
+            int ub = layerStart[l - 1], ue = layerStart[l];
+            int vb = layerStart[l], ve = layerStart[l + 1];
+            for (int v = vb; v < ve; ++v) {
+                for (int u = ub; u < ue; ++u) {
+                    if (dist(random) < density) {
+                        po.push_back(make_pair(u, v));
+                        hasParent[v] = true;
+                        hasChild[u] = true;
+                    }
+                }
+                // no new sources below the first layer
+                if (!hasParent[v]) {
+                    int u = uniform_int_distribution<int>(ub, ue - 1)(random);
+                    po.push_back(make_pair(u, v));
+                    hasParent[v] = true;
+                    hasChild[u] = true;
+                }
+            }
+            // nor sinks above the last one
+            for (int u = ub; u < ue; ++u) {
+                if (!hasChild[u]) {
+                    int v = uniform_int_distribution<int>(vb, ve - 1)(random);
+                    po.push_back(make_pair(u, v));
+                    hasChild[u] = true;
+                }
+            }
+        }
+        g->AddEdges(po, true);
     }
 
-    void RandomDag(Graph * g, random_engine & random, int leave) {
-        
+    void RandomDag(Graph * g, random_engine & random, int width, int depth, double density,
+                   int sinks, vector<int> & threadId) {
+        int begin = g->vertices.size();
+        RandomDag(g, random, width, depth, density, sinks);
+
+        // chains: a vertex continues the thread of its first parent that no
+        // other child continued yet, or starts a new one; the in edges of a
+        // new vertex are its parents in the order they were drawn
+        threadId.assign(g->vertices.size(), -1);
+        vector<bool> continued(g->vertices.size(), false);
+        int threads = 0;
+        for (int v = begin; v < g->vertices.size(); ++v) {
+            for (auto e : g->vertices[v]->inEdges) {
+                int u = e->from->id;
+                if (!continued[u]) {
+                    continued[u] = true;
+                    threadId[v] = threadId[u];
+                    break;
+                }
+            }
+            if (threadId[v] < 0) threadId[v] = threads++;
+        }
     }
 }
@@ -14,9 +14,21 @@ namespace Generator {
     void AddUniformPairDependency(Graph * g, random_engine & random, double density);
     void AddRWDependency(Graph * g, random_engine & random, double idleRatio, double rwRatio, double skew, int total, std::map<int, std::tuple<int, bool>> & rwInfo);
     void AddRWDistDependency(Graph * g, random_engine & engine, const std::vector<int> & rwDist, std::map<int, std::tuple<int, bool>> & rwInfo);
+    // Pairs of reads of the same object, by first and then second vertex id,
+    // for the "# RRDEP" section. Idle vertices of AddRWDependency count as
+    // readers of one more object.
+    void ReadReadDependencies(const std::map<int, std::tuple<int, bool>> & rwInfo, std::vector<std::pair<int, int>> & out);
 
     void RandomTree(Graph * g, random_engine & random);
-    void RandomDag(Graph * g, random_engine & random, int leave);
+    // `depth` layers of 1 to `width` vertices, the last one of `sinks`
+    // vertices. Each vertex gets a directed edge from every vertex of the
+    // previous layer with probability `density`, and at least one parent
+    // and one child outside the first and last layers.
+    void RandomDag(Graph * g, random_engine & random, int width, int depth, double density,
+                   int sinks);
+    // Same DAG, with threadId splitting the new vertices into chains
+    void RandomDag(Graph * g, random_engine & random, int width, int depth, double density,
+                   int sinks, std::vector<int> & threadId);
 }
 
 #endif
@@ -2,7 +2,9 @@
 #include "Generators.hpp"
 #include "Schedulers.hpp"
 #include "PorStat.hpp"
+#include "Counting.hpp"
 #include <cassert>
+#include <climits>
 #include <iostream>
 #include <string>
 #include <regex>
@@ -54,6 +56,23 @@ int main(int argc, char ** argv) {
         passes = stoi(opts["passes"]);
     }
 
+    int threads = 1;
+    if (opts.find("threads") != opts.end()) {
+        threads = max(1, stoi(opts["threads"]));
+    }
+
+    int splitDepth = 6;
+    if (opts.find("split-depth") != opts.end()) {
+        splitDepth = stoi(opts["split-depth"]);
+    }
+
+    // "dfs" (sleep-set DFS, split over threads) or "odpor" (optimal DPOR,
+    // single threaded)
+    string explorer = "dfs";
+    if (opts.find("explorer") != opts.end()) {
+        explorer = opts["explorer"];
+    }
+
     if (opts.find("progress-report") != opts.end()) {
         report = stoi(opts["progress-report"]);
     }
@@ -110,8 +129,27 @@ int main(int argc, char ** argv) {
         }
         DoubleTreeSkeleton(g, depth);
     }
+    else if (name == "random-dag") {
+        int width = 4;
+        int depth = 4;
+        double density = 0.3;
+        int sinks = 1;
+        if (opts.find("rd.width") != opts.end()) {
+            width = stoi(opts["rd.width"]);
+        }
+        if (opts.find("rd.depth") != opts.end()) {
+            depth = stoi(opts["rd.depth"]);
+        }
+        if (opts.find("rd.density") != opts.end()) {
+            density = stod(opts["rd.density"]);
+        }
+        if (opts.find("rd.sinks") != opts.end()) {
+            sinks = stoi(opts["rd.sinks"]);
+        }
+        RandomDag(g, random, width, depth, density, sinks);
+    }
 
-    if (name == "anti-chain" || name == "rainbow" || name == "double-tree") {
+    if (name == "anti-chain" || name == "rainbow" || name == "double-tree" || name == "random-dag") {
         string depName = "uniform";
 
         if (opts.find("dep-name") != opts.end()) {
@@ -152,39 +190,65 @@ int main(int argc, char ** argv) {
         }
     }
 
-    int groundTruth;
-    {
-        porTree = new PorTree(g);
-        auto e = Systematic::CreateDfsExplorer();
-        e->Begin(g);
-        vector<Vertex *> order;
-        while (true) {
-            if (!e->Explore(order)) break;
-
-            DBG(DBG_MAIN, {
-                    bool first = true;
-                    for (auto v : order) {
-                        if (first) first = false;
-                        else cout << ',';
-                        cout << v->id;
-                    }
-                    cout << endl;
-                });
-            int oldSize = porTree->GetRoot()->size;
-            porTree->AddPath(order);
-            assert(oldSize < porTree->GetRoot()->size);
-            assert(porTree->GetRoot()->minHit == 1);
-
-            cerr << porTree->GetRoot()->size << endl;
-        }
-        e->End();
-        cout << "total: " << porTree->GetRoot()->size << endl;
-        groundTruth = porTree->GetRoot()->size;
-        delete porTree;
+    int groundTruth = 0;
+    if (opts.find("count-only") != opts.end()) {
+        // exact counts from the downset DP, nothing is enumerated
+        BigUInt traces = Counting::CountTraces(g);
+        cout << "orders: " << Counting::CountOrders(g).ToString() << endl;
+        cout << "total: " << traces.ToString() << endl;
+        groundTruth = min<uint64_t>(traces.Saturated(), INT_MAX);
+    }
+    else {
+        // subtrees below a fixed depth are counted in parallel, each checking
+        // that its orders fall in distinct classes
+        bool optimal = explorer == "odpor";
+        auto prefixes = optimal
+            ? vector<vector<Vertex *>>(1)
+            : Systematic::SplitDfs(g, splitDepth, true);
+        vector<int> counts(prefixes.size());
+        Systematic::RunOrdered(prefixes.size(), threads,
+                               [&](int t) {
+                                   PorTree localTree(g);
+                                   auto e = optimal
+                                       ? Systematic::CreateOptimalDporExplorer()
+                                       : Systematic::CreateDfsExplorer(prefixes[t]);
+                                   e->Begin(g);
+                                   vector<Vertex *> order;
+                                   while (true) {
+                                       if (!e->Explore(order)) break;
+
+                                       DBG(DBG_MAIN, {
+                                               bool first = true;
+                                               for (auto v : order) {
+                                                   if (first) first = false;
+                                                   else cout << ',';
+                                                   cout << v->id;
+                                               }
+                                               cout << endl;
+                                           });
+                                       int oldSize = localTree.GetRoot()->size;
+                                       localTree.AddPath(order);
+                                       assert(oldSize < localTree.GetRoot()->size);
+                                       assert(localTree.GetRoot()->minHit == 1);
+                                   }
+                                   e->End();
+                                   delete e;
+                                   counts[t] = localTree.GetRoot()->size;
+                               },
+                               [&](int t) {
+                                   groundTruth += counts[t];
+                                   cerr << groundTruth << endl;
+                               });
+        cout << "total: " << groundTruth << endl;
     }
 
     if (report == 0) report = groundTruth;
 
+    const CsrGraph & csr = g->Freeze();
+    SamplerWorkspace ws(csr);
+    vector<int> ids(csr.Size());
+    vector<Vertex *> order;
+
     for (auto && algoName : evList) {
         porTree = new PorTree(g);
         int passCount = 0;
@@ -192,23 +256,31 @@ int main(int argc, char ** argv) {
 
         while ((passes < 0 || passCount < passes) &&
                (porTree->GetRoot()->size < groundTruth || porTree->GetRoot()->minHit < minHit)) {
-            map<Vertex *, int> orderMap;
-            vector<Vertex *> order;
-
             if ((passCount + 1) % report == 0) {
                 cerr << porTree->GetRoot()->size << '(' << groundTruth << ") "
                      << porTree->GetRoot()->minHit << '(' << minHit << ") "
                      << passCount + 1 << endl;
             }
 
+            bool sampled = true;
             if (algoName == "random-walk.basic") {
-                RandomWalk::Basic(g, algoRandom, orderMap, order);
+                RandomWalk::Basic(algoRandom, ws, ids.data());
             }
             else if (algoName == "pos.basic") {
-                Pos::Basic(g, algoRandom, orderMap, order);
+                Pos::Basic(algoRandom, ws, ids.data());
             }
             else if (algoName == "pos.dep-based") {
-                Pos::DependencyBased(g, algoRandom, orderMap, order);
+                Pos::DependencyBased(algoRandom, ws, ids.data());
+            }
+            else {
+                sampled = false;
+            }
+
+            order.clear();
+            if (sampled) {
+                for (auto v : ids) {
+                    order.push_back(csr.vertices[v]);
+                }
             }
 
             DBG(DBG_MAIN, {
@@ -1,151 +1,237 @@
 #include "PorStat.hpp"
 #include <algorithm>
-#include <set>
 #include <cassert>
+#include <cstdlib>
 #include <iostream>
+#include <new>
 
 #define DBG_POR_STAT 0
 
 using namespace std;
 
-PorTree::PorTree(Graph * g)
-    : _graph(g) {
+static inline unsigned HashId(int id) {
+    return (unsigned)id * 2654435761u;
+}
+
+int PorNode::FindSpilled(int id) const {
+    unsigned mask = 2 * spillCapacity - 1;
+    for (unsigned slot = HashId(id) & mask; spillHash[slot] >= 0; slot = (slot + 1) & mask) {
+        if (spillIds[spillHash[slot]] == id) return spillHash[slot];
+    }
+    return -1;
 }
 
-static void FreeSubtree(PorNode * n) {
-    for (auto c : n->children) {
-        FreeSubtree(c);
-        delete c;
+void PorNode::InsertHash(int i) {
+    unsigned mask = 2 * spillCapacity - 1;
+    unsigned slot = HashId(spillIds[i]) & mask;
+    while (spillHash[slot] >= 0) {
+        slot = (slot + 1) & mask;
     }
+    spillHash[slot] = i;
 }
 
+void PorNode::AddChild(int id, PorNode * child, Arena & arena) {
+    assert(Find(id) < 0);
+    if (spillIds == nullptr && childCount < POR_NODE_INLINE_CHILDREN) {
+        inlineIds[childCount] = id;
+        inlineChildren[childCount] = child;
+        ++childCount;
+        return;
+    }
+
+    if (spillIds == nullptr || childCount == spillCapacity) {
+        // old arrays stay in the arena until the tree goes away
+        int cap = spillCapacity == 0 ? 2 * POR_NODE_INLINE_CHILDREN : 2 * spillCapacity;
+        int * ids = static_cast<int *>(arena.Allocate(cap * sizeof(int), alignof(int)));
+        PorNode ** children = static_cast<PorNode **>(arena.Allocate(cap * sizeof(PorNode *), alignof(PorNode *)));
+        for (int i = 0; i < childCount; ++i) {
+            ids[i] = ChildId(i);
+            children[i] = Child(i);
+        }
+        spillIds = ids;
+        spillChildren = children;
+        spillCapacity = cap;
+        spillHash = static_cast<int *>(arena.Allocate(2 * cap * sizeof(int), alignof(int)));
+        fill(spillHash, spillHash + 2 * cap, -1);
+        for (int i = 0; i < childCount; ++i) {
+            InsertHash(i);
+        }
+    }
+
+    spillIds[childCount] = id;
+    spillChildren[childCount] = child;
+    InsertHash(childCount);
+    ++childCount;
+}
+
+PorTree::CheckPolicy PorTree::_defaultCheck = (PorTree::CheckPolicy)POR_CHECK_DEFAULT;
+
+PorTree::PorTree(Graph * g)
+    : _graph(g), _leafCount(0), _check(_defaultCheck), _pathCount(0), _words(0) {
+}
+
+bool PorTree::ParseCheckPolicy(const string & name, CheckPolicy & p) {
+    if (name == "off") p = CHECK_OFF;
+    else if (name == "sampled") p = CHECK_SAMPLED;
+    else if (name == "always") p = CHECK_ALWAYS;
+    else return false;
+    return true;
+}
+
+// Nodes are released with the arena in one go
 PorTree::~PorTree() {
-    FreeSubtree(&_root);
+}
+
+PorNode * PorTree::NewNode() {
+    return new (_arena.Allocate(sizeof(PorNode), alignof(PorNode))) PorNode();
+}
+
+static inline bool TestBit(const uint64_t * b, int i) { return (b[i >> 6] >> (i & 63)) & 1; }
+static inline void SetBit(uint64_t * b, int i) { b[i >> 6] |= (uint64_t)1 << (i & 63); }
+static inline void ClearBit(uint64_t * b, int i) { b[i >> 6] &= ~((uint64_t)1 << (i & 63)); }
+
+void PorTree::BuildDependencies(const CsrGraph & csr) {
+    int n = csr.Size();
+    _words = (n + 63) / 64;
+    _depRows.assign((size_t)n * _words, 0);
+    for (int v = 0; v < n; ++v) {
+        for (auto d = csr.DepBegin(v); d != csr.DepEnd(v); ++d) {
+            SetBit(&_depRows[(size_t)v * _words], *d);
+        }
+    }
+
+    _sleep.resize(_words);
+    _sleepPos.resize(n);
+    _sleepLevels.reserve(n);
+    _levelStart.reserve(n);
+    _nodeStack.reserve(n + 1);
+}
+
+void PorTree::CheckPath(const CsrGraph & csr) {
+    auto & index = _index;
+    index.assign(csr.Size(), -1);
+    bool ok = _porPath.size() == csr.Size();
+    for (int i = 0; ok && i < _porPath.size(); ++i) {
+        int v = _porPath[i];
+        ok = v >= 0 && v < csr.Size() && index[v] < 0;
+        if (ok) index[v] = i;
+    }
+
+    for (int v = 0; ok && v < csr.Size(); ++v) {
+        for (auto s = csr.SuccBegin(v); s != csr.SuccEnd(v); ++s) {
+            if (index[v] >= index[*s]) {
+                ok = false;
+                break;
+            }
+        }
+    }
+
+    if (!ok) {
+        cerr << "PorTree: path " << _pathCount << " is not a linearization of the graph" << endl;
+        abort();
+    }
 }
 
 PorNode * PorTree::AddPath(const vector<Vertex *> & path) {
-    vector<Vertex *> porPath(path);
+    const CsrGraph & csr = _graph->Freeze();
+    if (_depRows.size() == 0 && csr.Size() > 0) {
+        BuildDependencies(csr);
+    }
+
+    auto & porPath = _porPath;
+    porPath.resize(path.size());
+    for (size_t i = 0; i < path.size(); ++i) {
+        porPath[i] = path[i]->id;
+    }
     PorNode * cur = &_root;
     size_t pos = 0;
-    map<Vertex *, set<Vertex *>> dependencies;
-    map<Vertex *, size_t> sleepSet;
-    vector<vector<Vertex *>> sleepSetStack;
-    vector<PorNode *> nodeStack = { cur };
-
-    {
-        map<Vertex *, int> index;
-        for (int i = 0; i < path.size(); ++i) {
-            index[path[i]] = i;
-        }
-
-        for (auto v : _graph->vertices) {
-            assert(index.find(v) != index.end());
-            for (auto e : v->outEdges) {
-                if (e->IsDirected()) {
-                    assert(index.find(e->to) != index.end());
-                    assert(index[v] < index[e->to]);
-                }
-            }
-        }
+    uint64_t * sleep = _sleep.data();
+    fill(_sleep.begin(), _sleep.end(), 0);
+    _sleepLevels.clear();
+    _levelStart.clear();
+    auto & nodeStack = _nodeStack;
+    nodeStack.assign(1, cur);
+
+    if (_check == CHECK_ALWAYS ||
+        (_check == CHECK_SAMPLED && _pathCount % POR_CHECK_PERIOD == 0)) {
+        CheckPath(csr);
     }
+    ++_pathCount;
 
     while (pos < porPath.size()) {
-        Vertex * v = porPath[pos];
+        int v = porPath[pos];
 
         DBG(DBG_POR_STAT, {
                 bool first = true;
-                for (auto && kv : sleepSet) {
+                for (int u = 0; u < csr.Size(); ++u) {
+                    if (!TestBit(sleep, u)) continue;
                     if (first) first = false;
                     else cout << ',';
-                    cout << kv.first->id;
+                    cout << u;
                 }
                 cout << endl;
-                cout << pos << ':' << v->id << endl;
+                cout << pos << ':' << v << endl;
             });
 
-        {
-            auto it = sleepSet.find(v);
-            if (it != sleepSet.end()) {
-                size_t btPos = it->second;
+        if (TestBit(sleep, v)) {
+            size_t btPos = _sleepPos[v];
 
-                DBG(DBG_POR_STAT, { cout << "swap " << btPos << " and " << pos << endl; });
+            DBG(DBG_POR_STAT, { cout << "swap " << btPos << " and " << pos << endl; });
 
-                for (size_t i = pos; i > btPos; --i) {
-                    swap(porPath[i], porPath[i - 1]);
-                }
+            for (size_t i = pos; i > btPos; --i) {
+                swap(porPath[i], porPath[i - 1]);
+            }
 
-                while (btPos < sleepSetStack.size()) {
-                    auto && head = sleepSetStack.back();
-                    DBG(DBG_POR_STAT, {
-                            cout << "pop sleep set: ";
-                            bool first = true;
-                            for (auto v : head) {
-                                if (first) first = false;
-                                else cout << ',';
-                                cout << v->id;
-                            }
-                            cout << endl;
-                        });
-
-                    for (auto v : head) {
-                        sleepSet.erase(v);
-                    }
-                    sleepSetStack.pop_back();
+            while (btPos < _levelStart.size()) {
+                DBG(DBG_POR_STAT, {
+                        cout << "pop sleep set: ";
+                        bool first = true;
+                        for (size_t i = _levelStart.back(); i < _sleepLevels.size(); ++i) {
+                            if (first) first = false;
+                            else cout << ',';
+                            cout << _sleepLevels[i];
+                        }
+                        cout << endl;
+                    });
+
+                for (size_t i = _levelStart.back(); i < _sleepLevels.size(); ++i) {
+                    ClearBit(sleep, _sleepLevels[i]);
                 }
-
-                pos = btPos;
-                cur = nodeStack[pos];
-                nodeStack.resize(pos + 1);
-                continue;
+                _sleepLevels.resize(_levelStart.back());
+                _levelStart.pop_back();
             }
+
+            pos = btPos;
+            cur = nodeStack[pos];
+            nodeStack.resize(pos + 1);
+            continue;
         }
 
         if (cur != nullptr) {
-            auto it = cur->index.find(v);
-            size_t idx;
-
-            if (it == cur->index.end()) {
-                idx = cur->children.size();
-            }
-            else {
-                idx = it->second;
-            }
-
-            sleepSetStack.push_back({});
-            auto && level = sleepSetStack.back();
-            for (size_t i = 0; i < idx; ++i) {
-                level.push_back(cur->vertices[i]);
-                sleepSet[cur->vertices[i]] = pos;
+            int found = cur->Find(v);
+            int idx = found < 0 ? cur->childCount : found;
+
+            _levelStart.push_back(_sleepLevels.size());
+            for (int i = 0; i < idx; ++i) {
+                int u = cur->ChildId(i);
+                _sleepLevels.push_back(u);
+                SetBit(sleep, u);
+                _sleepPos[u] = pos;
             }
 
-            if (it == cur->index.end()) {
+            if (found < 0) {
                 cur = nullptr;
             }
             else {
-                cur = cur->children[it->second];
+                cur = cur->Child(found);
                 nodeStack.push_back(cur);
             }
         }
 
-        vector<Vertex *> wakeup;
-        for (auto && kv : sleepSet) {
-            auto depIt = dependencies.find(kv.first);
-            if (depIt == dependencies.end()) {
-                // find dependency set and cache it
-                tie(depIt, std::ignore) = dependencies.emplace(kv.first, set<Vertex *>{});
-                for (auto e : kv.first->outEdges) {
-                    if (e->IsDirected()) continue;
-                    depIt->second.insert(e->to);
-                }
-            }
-
-            if (depIt->second.find(v) != depIt->second.end()) {
-                wakeup.push_back(kv.first);
-            }
-        }
-
-        for (auto v : wakeup) {
-            sleepSet.erase(v);
+        // wake up everything dependent on v
+        const uint64_t * dep = &_depRows[(size_t)v * _words];
+        for (int w = 0; w < _words; ++w) {
+            sleep[w] &= ~dep[w];
         }
 
         ++pos;
@@ -157,77 +243,60 @@ PorNode * PorTree::AddPath(const vector<Vertex *> & path) {
             for (auto v : porPath) {
                 if (first) first = false;
                 else cout << ',';
-                cout << v->id;
+                cout << v;
             }
             cout << endl;
         });
 
     pos = 0;
-    sleepSet.clear();
+    fill(_sleep.begin(), _sleep.end(), 0);
     cur = &_root;
-    nodeStack.clear();
-    nodeStack.push_back(cur);
+    nodeStack.assign(1, cur);
     bool newPath = false;
 
     while (pos < porPath.size()) {
-        Vertex * v = porPath[pos];
+        int v = porPath[pos];
 
-        assert(sleepSet.find(v) == sleepSet.end());
-        auto it = cur->index.find(v);
-        size_t idx;
+        assert(!TestBit(sleep, v));
+        int idx = cur->Find(v);
 
-        if (it == cur->index.end()) {
-            idx = cur->children.size();
-            tie(it, std::ignore) = cur->index.emplace(v, idx);
-            cur->vertices.push_back(v);
-            cur->children.push_back(new PorNode());
+        if (idx < 0) {
+            idx = cur->childCount;
+            cur->AddChild(v, NewNode(), _arena);
 
             newPath = true;
         }
-        else {
-            idx = it->second;
-        }
 
-        for (size_t i = 0; i < idx; ++i) {
-            sleepSet[cur->vertices[i]] = pos;
-        }
-
-        vector<Vertex *> wakeup;
-        for (auto && kv : sleepSet) {
-            auto depIt = dependencies.find(kv.first);
-            if (depIt == dependencies.end()) {
-                // find dependency set and cache it
-                tie(depIt, std::ignore) = dependencies.emplace(kv.first, set<Vertex *>{});
-                for (auto e : kv.first->outEdges) {
-                    if (e->IsDirected()) continue;
-                    depIt->second.insert(e->to);
-                }
-            }
-
-            if (depIt->second.find(v) != depIt->second.end()) {
-                wakeup.push_back(kv.first);
-            }
+        for (int i = 0; i < idx; ++i) {
+            SetBit(sleep, cur->ChildId(i));
         }
 
-        for (auto v : wakeup) {
-            sleepSet.erase(v);
+        const uint64_t * dep = &_depRows[(size_t)v * _words];
+        for (int w = 0; w < _words; ++w) {
+            sleep[w] &= ~dep[w];
         }
 
-        cur = cur->children[it->second];
+        cur = cur->Child(idx);
         ++pos;
 
         nodeStack.push_back(cur);
     }
 
     auto ret = nodeStack.back();
+    if (ret->leafIndex < 0) {
+        // also the case of the empty path, which adds no node
+        ret->leafIndex = _leafCount++;
+        newPath = true;
+    }
 
     while (nodeStack.size() > 0) {
+        PorNode * n = nodeStack.back();
         if (newPath)
-            ++nodeStack.back()->size;
-        ++nodeStack.back()->minHit;
-        for (auto c : nodeStack.back()->children) {
-            if (c->minHit < nodeStack.back()->minHit) {
-                nodeStack.back()->minHit = c->minHit;
+            ++n->size;
+        ++n->minHit;
+        for (int i = 0; i < n->childCount; ++i) {
+            if (n->Child(i)->minHit < n->minHit) {
+                n->minHit = n->Child(i)->minHit;
             }
         }
         nodeStack.pop_back();
@@ -235,3 +304,136 @@ PorNode * PorTree::AddPath(const vector<Vertex *> & path) {
 
     return ret;
 }
+
+namespace Trace {
+    class PorTreeClassifier : public IClassifier {
+        PorTree _tree;
+
+    public:
+        PorTreeClassifier(Graph * g) : _tree(g) { }
+
+        int Classify(const vector<Vertex *> & order, bool & isNew) {
+            size_t before = _tree.LeafCount();
+            int ret = _tree.AddPath(order)->leafIndex;
+            isNew = _tree.LeafCount() > before;
+            return ret;
+        }
+
+        size_t ClassCount() const { return _tree.LeafCount(); }
+        size_t PeakBytes() const { return _tree.PeakBytes(); }
+    };
+
+    static inline uint64_t Mix64(uint64_t x) {
+        x ^= x >> 30;
+        x *= 0xbf58476d1ce4e5b9ull;
+        x ^= x >> 27;
+        x *= 0x94d049bb133111ebull;
+        x ^= x >> 31;
+        return x;
+    }
+
+    // The Foata normal form of a trace puts every event in the step given by
+    // the longest chain of program order and dependency edges ending in it,
+    // so the per-vertex step numbers determine the form. Their 128-bit
+    // fingerprint keys an open addressing table of classes.
+    class FoataClassifier : public IClassifier {
+        struct Slot {
+            uint64_t hi;
+            uint64_t lo;
+            int cls; // -1 if empty
+        };
+
+        Graph * _graph;
+        vector<Slot> _table;
+        size_t _count;
+        vector<int> _step;
+        vector<bool> _placed;
+
+        void Insert(const Slot & s) {
+            size_t mask = _table.size() - 1;
+            size_t i = s.hi & mask;
+            while (_table[i].cls >= 0) {
+                i = (i + 1) & mask;
+            }
+            _table[i] = s;
+        }
+
+        void Grow() {
+            vector<Slot> old(_table.size() * 2, Slot{ 0, 0, -1 });
+            old.swap(_table);
+            for (auto && s : old) {
+                if (s.cls >= 0) Insert(s);
+            }
+        }
+
+    public:
+        FoataClassifier(Graph * g)
+            : _graph(g), _table(64, Slot{ 0, 0, -1 }), _count(0) { }
+
+        int Classify(const vector<Vertex *> & order, bool & isNew) {
+            const CsrGraph & csr = _graph->Freeze();
+            _step.assign(csr.Size(), 0);
+            _placed.assign(csr.Size(), false);
+
+            for (auto vp : order) {
+                int v = vp->id;
+                int step = _step[v];
+                for (auto d = csr.DepBegin(v); d != csr.DepEnd(v); ++d) {
+                    if (_placed[*d] && _step[*d] >= step) {
+                        step = _step[*d] + 1;
+                    }
+                }
+                _step[v] = step;
+                _placed[v] = true;
+                for (auto s = csr.SuccBegin(v); s != csr.SuccEnd(v); ++s) {
+                    if (_step[*s] <= step) {
+                        _step[*s] = step + 1;
+                    }
+                }
+            }
+
+            uint64_t hi = 0x9e3779b97f4a7c15ull;
+            uint64_t lo = 0x243f6a8885a308d3ull;
+            for (auto step : _step) {
+                hi = Mix64(hi + (uint64_t)step);
+                lo = Mix64(lo ^ ((uint64_t)step * 0xff51afd7ed558ccdull + 1));
+            }
+
+            size_t mask = _table.size() - 1;
+            for (size_t i = hi & mask; _table[i].cls >= 0; i = (i + 1) & mask) {
+                if (_table[i].hi == hi && _table[i].lo == lo) {
+                    isNew = false;
+                    return _table[i].cls;
+                }
+            }
+
+            if (2 * (_count + 1) > _table.size()) {
+                Grow();
+            }
+            Insert(Slot{ hi, lo, (int)_count });
+            isNew = true;
+            return _count++;
+        }
+
+        size_t ClassCount() const { return _count; }
+
+        size_t PeakBytes() const {
+            return _table.capacity() * sizeof(Slot) +
+                _step.capacity() * sizeof(int) + _placed.capacity() / 8;
+        }
+    };
+
+    IClassifier * CreatePorTreeClassifier(Graph * g) {
+        return new PorTreeClassifier(g);
+    }
+
+    IClassifier * CreateFoataClassifier(Graph * g) {
+        return new FoataClassifier(g);
+    }
+
+    IClassifier * CreateClassifier(const string & name, Graph * g) {
+        if (name == "portree") return CreatePorTreeClassifier(g);
+        if (name == "foata") return CreateFoataClassifier(g);
+        return nullptr;
+    }
+}
@@ -3,23 +3,96 @@
 
 #include "Base.hpp"
 
-#include <map>
+#include <cstdint>
+#include <string>
 #include <vector>
 
+#define POR_NODE_INLINE_CHILDREN 4
+
+// Children are kept in insertion order and keyed by vertex id. The first few
+// live inline and are searched linearly, so a lookup in a node of small
+// fan-out touches a single cache line. Past POR_NODE_INLINE_CHILDREN they
+// move to arena arrays indexed by an open addressing hash.
 struct PorNode {
+    int childCount;
+    int leafIndex; // dense index in discovery order, -1 for inner nodes
+    int inlineIds[POR_NODE_INLINE_CHILDREN];
+    PorNode * inlineChildren[POR_NODE_INLINE_CHILDREN];
     size_t size;
     size_t minHit;
-    std::map<Vertex *, size_t> index;
-    std::vector<Vertex *> vertices;
-    std::vector<PorNode *> children;
+    // spilled children, nullptr while they fit inline
+    int * spillIds;
+    PorNode ** spillChildren;
+    int * spillHash; // child index per slot, -1 if empty
+    int spillCapacity;
+
+    PorNode()
+        : childCount(0), leafIndex(-1), size(0), minHit(0),
+          spillIds(nullptr), spillChildren(nullptr), spillHash(nullptr), spillCapacity(0) { }
+
+    inline int ChildId(int i) const { return spillIds == nullptr ? inlineIds[i] : spillIds[i]; }
+    inline PorNode * Child(int i) const { return spillIds == nullptr ? inlineChildren[i] : spillChildren[i]; }
+
+    // Returns the index of the child reached by vertex id, or -1
+    inline int Find(int id) const {
+        if (spillHash != nullptr) return FindSpilled(id);
+        for (int i = 0; i < childCount; ++i) {
+            if (inlineIds[i] == id) return i;
+        }
+        return -1;
+    }
+
+    void AddChild(int id, PorNode * child, Arena & arena);
 
-    PorNode() : size(0), minHit(0) { }
+private:
+    int FindSpilled(int id) const;
+    void InsertHash(int i);
 };
 
+// Default for checking that AddPath gets a complete order respecting every
+// directed edge: 0 off, 1 sampled, 2 always. Debug builds always check.
+#ifndef POR_CHECK_DEFAULT
+#ifdef NDEBUG
+#define POR_CHECK_DEFAULT 0
+#else
+#define POR_CHECK_DEFAULT 2
+#endif
+#endif
+
+// Under the sampled policy, one in this many paths is checked
+#define POR_CHECK_PERIOD 1024
+
 class PorTree {
+public:
+    enum CheckPolicy { CHECK_OFF = 0, CHECK_SAMPLED = 1, CHECK_ALWAYS = 2 };
+
+private:
+    static CheckPolicy _defaultCheck;
 
     Graph * _graph;
+    Arena _arena;
     PorNode _root;
+    size_t _leafCount;
+    CheckPolicy _check;
+    size_t _pathCount;
+
+    // Dependency bitset of every vertex, built on the first AddPath
+    int _words; // 64-bit words per bitset
+    std::vector<uint64_t> _depRows;
+
+    // Scratch reused across AddPath calls
+    std::vector<int> _porPath;
+    std::vector<int> _index;
+    std::vector<uint64_t> _sleep;
+    std::vector<size_t> _sleepPos; // step that put a sleeping vertex to sleep
+    std::vector<int> _sleepLevels; // vertices put to sleep per step, flattened
+    std::vector<size_t> _levelStart;
+    std::vector<PorNode *> _nodeStack;
+
+    PorNode * NewNode();
+    void BuildDependencies(const CsrGraph & csr);
+    // Aborts unless _porPath is a linearization of the graph
+    void CheckPath(const CsrGraph & csr);
 
 public:
 
@@ -28,6 +101,32 @@ public:
 
     PorNode * AddPath(const std::vector<Vertex *> & path);
     inline PorNode * GetRoot() { return &_root; }
+    inline size_t LeafCount() const { return _leafCount; }
+    inline size_t PeakBytes() const { return _arena.Bytes(); }
+
+    inline void SetCheckPolicy(CheckPolicy p) { _check = p; }
+    // Policy of trees created afterwards
+    static inline void SetDefaultCheckPolicy(CheckPolicy p) { _defaultCheck = p; }
+    // "off", "sampled" or "always"; returns false for other names
+    static bool ParseCheckPolicy(const std::string & name, CheckPolicy & p);
 };
 
+namespace Trace {
+    // Identifies the partial order class (Mazurkiewicz trace) of total
+    // orders. Classes are numbered densely in discovery order.
+    class IClassifier {
+    public:
+        // Returns the class of order and sets isNew if it was not seen before
+        virtual int Classify(const std::vector<Vertex *> & order, bool & isNew) = 0;
+        virtual size_t ClassCount() const = 0;
+        virtual size_t PeakBytes() const = 0;
+        virtual ~IClassifier() { }
+    };
+
+    IClassifier * CreatePorTreeClassifier(Graph * g);
+    IClassifier * CreateFoataClassifier(Graph * g);
+    // "portree" or "foata", nullptr for other names
+    IClassifier * CreateClassifier(const std::string & name, Graph * g);
+}
+
 #endif
@@ -1,8 +1,14 @@
 #include "Schedulers.hpp"
+#include <atomic>
+#include <condition_variable>
 #include <iostream>
+#include <memory>
+#include <mutex>
+#include <thread>
 #include <random>
 #include <map>
 #include <set>
+#include <algorithm>
 #include <cassert>
 
 #define DBG_SCH 0
@@ -11,176 +17,275 @@
 using namespace std;
 
 namespace Systematic {
+    // Depth-first enumeration of total orders that keeps the walk and sleep
+    // set of the current path on a stack. Moving to the next order undoes
+    // only the suffix below the deepest level with an untried child.
     class DfsExplorer : public IExplorer {
         Graph * _graph;
 
-        struct ExplNode {
-            map<Vertex *, int> index;
-            vector<Vertex *>   vertices;
+        // One level of the current path
+        struct Frame {
+            int candBegin;     // frontier on entry, in id order unless shuffled, in _cand
+            int candEnd;
+            int cursor;        // next candidate to try
+            int exploredBegin; // children tried so far, in _explored
+            int sleepMark;     // _sleepUndo size on entry
+            int choice;        // child being explored, -1 if none
         };
 
         bool _fSleepSet;
-        vector<ExplNode> _stack;
+        bool _fShuffle;
+        uint64_t _seed;
+        random_engine _random;
+        vector<int> _prefix; // only orders starting with it are explored
+        int _maxDepth;       // paths are emitted at this length, -1 for full orders
+        bool _pendingLeaf;   // the prefix itself is the only path left to emit
+        std::unique_ptr<TopoWalk> _walk;
+        vector<Frame> _stack;
+        vector<int> _cand;
+        vector<int> _explored;
+        vector<int> _path;
+        vector<bool> _asleep;
+        vector<int> _sleepUndo; // vertices whose _asleep flag was flipped
+
+        inline void SetAsleep(int v, bool asleep) {
+            if (_asleep[v] != asleep) {
+                _asleep[v] = asleep;
+                _sleepUndo.push_back(v);
+            }
+        }
+
+        inline void RestoreSleep(int mark) {
+            while (_sleepUndo.size() > mark) {
+                _asleep[_sleepUndo.back()] = !_asleep[_sleepUndo.back()];
+                _sleepUndo.pop_back();
+            }
+        }
+
+        void PushFrame() {
+            Frame f;
+            f.candBegin = f.cursor = _cand.size();
+            _cand.insert(_cand.end(), _walk->Frontier().begin(), _walk->Frontier().end());
+            f.candEnd = _cand.size();
+            if (_fShuffle) {
+                shuffle(_cand.begin() + f.candBegin, _cand.end(), _random);
+            }
+            f.exploredBegin = _explored.size();
+            f.sleepMark = _sleepUndo.size();
+            f.choice = -1;
+            _stack.push_back(f);
+        }
+
+        inline bool AtLeaf() const {
+            return _walk->Done() || (int)_path.size() == _maxDepth;
+        }
+
+        void Emit(vector<Vertex *> & outOrder) const {
+            const CsrGraph & csr = _walk->GetGraph();
+            outOrder.resize(_path.size());
+            for (int i = 0; i < _path.size(); ++i) {
+                outOrder[i] = csr.vertices[_path[i]];
+            }
+
+            DBG(DBG_SCH, {
+                    bool first = true;
+                    for (auto v : outOrder) {
+                        if (first) first = false;
+                        else cout << ' ';
+                        cout << v->id;
+                    }
+                    cout << endl;
+                });
+        }
+
+        // Walks down the prefix with the sleep sets the full enumeration has
+        // there. Prefix levels get no other children.
+        void EnterPrefix() {
+            const CsrGraph & csr = _walk->GetGraph();
+            for (int p : _prefix) {
+                Frame & f = _stack.back();
+                auto begin = _cand.begin() + f.candBegin;
+                auto end = _cand.begin() + f.candEnd;
+                auto it = find(begin, end, p);
+                if (it == end || (_fSleepSet && _asleep[p])) {
+                    // never reached by the full enumeration
+                    _stack.clear();
+                    return;
+                }
+
+                if (_fSleepSet) {
+                    // every sibling awake on entry is tried before p
+                    for (auto c = begin; c != it; ++c) {
+                        if (!_asleep[*c]) _explored.push_back(*c);
+                    }
+                    for (int i = f.exploredBegin; i < _explored.size(); ++i) {
+                        SetAsleep(_explored[i], true);
+                    }
+                    for (auto d = csr.DepBegin(p); d != csr.DepEnd(p); ++d) {
+                        SetAsleep(*d, false);
+                    }
+                }
+
+                f.cursor = f.candEnd;
+                f.choice = p;
+                _walk->Schedule(p);
+                _path.push_back(p);
+
+                if (AtLeaf()) {
+                    _pendingLeaf = true;
+                    return;
+                }
+                PushFrame();
+            }
+        }
 
     public:
         DfsExplorer()
-            : _fSleepSet(true)
+            : _fSleepSet(true), _fShuffle(false), _seed(0),
+              _maxDepth(-1), _pendingLeaf(false)
             { }
 
         void Begin(Graph * g) override {
             _graph = g;
-            _stack.push_back(ExplNode());
+            const CsrGraph & csr = g->Freeze();
+            _walk.reset(new TopoWalk(csr));
+            _random.seed(_seed);
+            _asleep.assign(csr.Size(), false);
+            _stack.reserve(csr.Size() + 1);
+            _path.reserve(csr.Size());
+            _pendingLeaf = false;
+            if (_walk->Done()) {
+                // no vertices: the root is the only leaf, with the empty order
+                _stack.clear();
+                _pendingLeaf = _prefix.empty();
+                return;
+            }
+            PushFrame();
+            EnterPrefix();
         }
 
         void SetUseSleepSet(bool use) {
             _fSleepSet = use;
         }
 
-        bool Explore(vector<Vertex *> & outOrder) override {
-            if (_stack.size() == 0) {
-                // Entire tree exhausted
-                return false;
-            }
-
-            outOrder.clear();
-
-            random_device rd;
-            uniform_real_distribution<double> dist(0.0, 1.0);
-            mt19937_64 random(rd());
-
-            map<Vertex *, int> inDegree;
-            set<Vertex *> frontier;
-
-            bool rejected;
-            do {
-                int level = 0;
-                rejected = false;
-                set<Vertex *> sleepSet;
-                outOrder.clear();
-
-                frontier.clear();
-                inDegree.clear();
-                for (auto v : _graph->vertices) {
-                    int d = 0;
-                    for (auto e : v->inEdges) {
-                        if (e->IsDirected()) {
-                            ++d;
-                        }
-                    }
+        void SetShuffle(bool shuffle, uint64_t seed) {
+            _fShuffle = shuffle;
+            _seed = seed;
+        }
 
-                    inDegree[v] = d;
-                    if (d == 0) {
-                        frontier.insert(v);
-                    }
-                }
+        void SetPrefix(const vector<Vertex *> & prefix) {
+            _prefix.clear();
+            for (auto v : prefix) {
+                _prefix.push_back(v->id);
+            }
+        }
 
-                while (frontier.size() > 0) {
-                    DBG(DBG_SCH, {
-                            cout << "frontier: ";
-                            bool first = true;
-                            for (auto v : frontier) {
-                                if (first) first = false;
-                                else cout << ' ';
-                                cout << v->id;
-                            }
+        void SetMaxDepth(int depth) {
+            _maxDepth = depth;
+        }
 
-                            cout << endl;
-                            if (_fSleepSet) {
-                                cout << "sleep set: ";
-                                first = true;
-                                for (auto v : sleepSet) {
-                                    if (first) first = false;
-                                    else cout << ' ';
-                                    cout << v->id;
-                                }
-                            }
-                            cout << endl;
-                        });
-
-                    Vertex * choice = nullptr;
-
-                    if (level == _stack.size() - 1) {
-                        // subtree is exhausted, pick some one that is not in index or sleep set
-                        for (auto v : frontier) {
-                            if (_stack[level].index.find(v) != _stack[level].index.end())
-                                continue;
-                            if (_fSleepSet && sleepSet.find(v) != sleepSet.end())
-                                continue;
-                            choice = v;
-                            break;
-                        }
+        bool Explore(vector<Vertex *> & outOrder) override {
+            const CsrGraph & csr = _walk->GetGraph();
 
-                        if (choice == nullptr) {
-                            // the current level is exhausted
-                            _stack.pop_back();
-                            rejected = true;
-                            break;
-                        }
-                        else {
-                            if (_fSleepSet) {
-                                for (auto v : _stack[level].vertices) {
-                                    sleepSet.insert(v);
-                                }
-                            }
+            if (_pendingLeaf) {
+                _pendingLeaf = false;
+                Emit(outOrder);
+                return true;
+            }
 
-                            _stack[level].index[choice] = _stack[level].vertices.size();
-                            _stack[level].vertices.push_back(choice);
-                            _stack.push_back(ExplNode());
-                        }
-                    }
-                    else {
-                        if (_fSleepSet) {
-                            for (int i = 0; i < _stack[level].vertices.size() - 1; ++i) {
-                                sleepSet.insert(_stack[level].vertices[i]);
-                            }
-                        }
-                        choice = _stack[level].vertices.back();
-                    }
+            while (_stack.size() > 0) {
+                Frame & f = _stack.back();
 
-                    DBG(DBG_SCH, cout << choice->id << endl);
+                if (f.choice >= 0) {
+                    // back from the subtree of the last child
+                    _walk->Unschedule(f.choice);
+                    _path.pop_back();
+                    f.choice = -1;
+                }
 
-                    for (auto e : choice->outEdges) {
-                        if (e->IsDirected()) {
-                            if (--inDegree[e->to] == 0) {
-                                frontier.insert(e->to);
-                            }
-                        }
-                        else {
-                            if (_fSleepSet) {
-                                sleepSet.erase(e->to);
-                            }
-                        }
+                // sleep set of the next child: the entry set plus the
+                // children already tried, minus what the child depends on
+                RestoreSleep(f.sleepMark);
+                if (_fSleepSet) {
+                    for (int i = f.exploredBegin; i < _explored.size(); ++i) {
+                        SetAsleep(_explored[i], true);
                     }
-
-                    ++level;
-                    frontier.erase(choice);
-                    outOrder.push_back(choice);
                 }
-            }
-            while (rejected && _stack.size() > 0);
 
-            if (rejected) {
-                return false;
-            }
-            else {
                 DBG(DBG_SCH, {
+                        cout << "frontier: ";
                         bool first = true;
-                        for (auto v : outOrder) {
+                        for (int i = f.candBegin; i < f.candEnd; ++i) {
                             if (first) first = false;
                             else cout << ' ';
-                            cout << v->id;
+                            cout << _cand[i];
+                        }
+                        cout << endl;
+                        if (_fSleepSet) {
+                            cout << "sleep set: ";
+                            first = true;
+                            for (int v = 0; v < _asleep.size(); ++v) {
+                                if (!_asleep[v]) continue;
+                                if (first) first = false;
+                                else cout << ' ';
+                                cout << v;
+                            }
                         }
                         cout << endl;
                     });
-                // the last node is a leaf, thus exhausted
-                _stack.pop_back();
-                return true;
+
+                int choice = -1;
+                while (f.cursor < f.candEnd) {
+                    int v = _cand[f.cursor++];
+                    if (!_fSleepSet || !_asleep[v]) {
+                        choice = v;
+                        break;
+                    }
+                }
+
+                if (choice < 0) {
+                    // the current level is exhausted
+                    RestoreSleep(f.sleepMark);
+                    _cand.resize(f.candBegin);
+                    _explored.resize(f.exploredBegin);
+                    _stack.pop_back();
+                    continue;
+                }
+
+                DBG(DBG_SCH, cout << choice << endl);
+
+                if (_fSleepSet) {
+                    for (auto d = csr.DepBegin(choice); d != csr.DepEnd(choice); ++d) {
+                        SetAsleep(*d, false);
+                    }
+                }
+
+                _explored.push_back(choice);
+                f.choice = choice;
+                _walk->Schedule(choice);
+                _path.push_back(choice);
+
+                if (AtLeaf()) {
+                    Emit(outOrder);
+                    return true;
+                }
+
+                PushFrame();
             }
+
+            // Entire tree exhausted
+            return false;
         }
 
         void End() override {
             _graph = nullptr;
+            _pendingLeaf = false;
+            _walk.reset();
             _stack.clear();
+            _cand.clear();
+            _explored.clear();
+            _path.clear();
+            _sleepUndo.clear();
         }
 
         ~DfsExplorer() override {
@@ -192,223 +297,650 @@ namespace Systematic {
         ret->SetUseSleepSet(sleepSet);
         return ret;
     }
-}
 
-void RandomWalk::Basic(Graph * g, random_engine & random, map<Vertex *, int> & outOrderMap, vector<Vertex *> & outOrder) {
-    outOrderMap.clear();
-    outOrder.clear();
+    IExplorer * CreateRandomizedDfsExplorer(uint64_t seed, bool sleepSet) {
+        auto ret = new DfsExplorer();
+        ret->SetUseSleepSet(sleepSet);
+        ret->SetShuffle(true, seed);
+        return ret;
+    }
 
-    uniform_real_distribution<double> dist(0.0, 1.0);
+    IExplorer * CreateDfsExplorer(const vector<Vertex *> & prefix, bool sleepSet) {
+        auto ret = new DfsExplorer();
+        ret->SetUseSleepSet(sleepSet);
+        ret->SetPrefix(prefix);
+        return ret;
+    }
+
+    // Optimal dynamic partial order reduction (source sets with wakeup
+    // trees) over the static dependency model: vertices are events, directed
+    // edges order them and undirected edges make them dependent. Every
+    // complete order ends a distinct trace and no path is sleep-set blocked.
+    // Races are collected at each leaf and the reversing sequences inserted
+    // into the wakeup trees of the levels where they start.
+    class OptimalDporExplorer : public IExplorer {
+        Graph * _graph;
+
+        // Wakeup tree node; children are a singly linked list in tree order
+        struct Node {
+            int event;
+            int first;
+            int last;
+            int next;
+        };
+
+        // One level of the current path. The wakeup tree of a level is the
+        // subtree of the node chosen at the level above.
+        struct Frame {
+            int root;
+            int sleepBegin; // sleep set in _sleep, up to the next frame's
+            int child;      // node being explored, -1 if none
+            bool fresh;     // entered with an empty wakeup tree
+        };
 
-    map<Vertex *, int> inDegree;
-    set<Vertex *> frontier;
+        int _words;
+        vector<uint64_t> _depRows; // undirected dependencies
+        vector<uint64_t> _relRows; // dependencies and directed edges, both ways
+        vector<int> _predStart;
+        vector<int> _pred;
+
+        std::unique_ptr<TopoWalk> _walk;
+        vector<Node> _nodes;
+        vector<int> _freeNodes;
+        vector<Frame> _stack;
+        vector<int> _sleep;
+        vector<int> _path;
+        vector<int> _pos;          // index in _path, Size() if not on it
+        vector<uint64_t> _hb;      // per path index, the indices happening before it
+        vector<uint64_t> _covered;
+        vector<int> _seq;
+        vector<int> _branch;       // events on the way down during Insert
+        vector<bool> _inBranch;
+        long _blocked;
+        bool _pendingLeaf;         // no events: the empty order is still to emit
+
+        inline bool Test(const vector<uint64_t> & rows, int a, int b) const {
+            return (rows[(size_t)a * _words + b / 64] >> (b % 64)) & 1;
+        }
 
-    for (auto v : g->vertices) {
-        int d = 0;
-        for (auto e : v->inEdges) {
-            if (e->IsDirected()) {
-                ++d;
+        int NewNode(int event) {
+            Node n = { event, -1, -1, -1 };
+            if (_freeNodes.empty()) {
+                _nodes.push_back(n);
+                return _nodes.size() - 1;
             }
+            int r = _freeNodes.back();
+            _freeNodes.pop_back();
+            _nodes[r] = n;
+            return r;
         }
 
-        inDegree[v] = d;
-        if (d == 0) {
-            frontier.insert(v);
+        int AppendChild(int parent, int event) {
+            int c = NewNode(event);
+            Node & p = _nodes[parent];
+            if (p.last < 0) p.first = c;
+            else _nodes[p.last].next = c;
+            p.last = c;
+            return c;
         }
-    }
 
-    while (frontier.size() > 0) {
-        Vertex * choice = nullptr;
-        double bestP;
+        inline bool IsPred(int u, int v) const {
+            for (int i = _predStart[v]; i < _predStart[v + 1]; ++i) {
+                if (_pred[i] == u) return true;
+            }
+            return false;
+        }
 
-        for (auto v : frontier) {
-            double p = dist(random);
+        inline int SleepEnd(int level) const {
+            return level + 1 < _stack.size() ? _stack[level + 1].sleepBegin : _sleep.size();
+        }
 
-            if (choice == nullptr || bestP < p) {
-                choice = v;
-                bestP = p;
+        inline bool Executed(int v, int level) const {
+            return _pos[v] < level || _inBranch[v];
+        }
+
+        // Whether p is a weak initial of _seq after the path up to `level`
+        // followed by the events marked in _inBranch
+        bool WeakInitial(int level, int p) const {
+            for (int x : _seq) {
+                if (x == p) return true;
+                if (Test(_relRows, x, p)) return false;
+            }
+            if (Executed(p, level)) return false;
+            for (int i = _predStart[p]; i < _predStart[p + 1]; ++i) {
+                if (!Executed(_pred[i], level)) return false;
             }
+            return true;
         }
 
-        for (auto e : choice->outEdges) {
-            if (e->IsDirected()) {
-                if (--inDegree[e->to] == 0) {
-                    frontier.insert(e->to);
+        // Inserts _seq into the wakeup tree of `level` unless a leaf already
+        // covers it
+        void Insert(int level) {
+            int node = _stack[level].root;
+            _branch.clear();
+            while (true) {
+                if (!_branch.empty() && _nodes[node].first < 0) break;
+
+                int found = -1;
+                for (int c = _nodes[node].first; c >= 0; c = _nodes[c].next) {
+                    if (WeakInitial(level, _nodes[c].event)) {
+                        found = c;
+                        break;
+                    }
                 }
+
+                if (found < 0) {
+                    for (int x : _seq) {
+                        node = AppendChild(node, x);
+                    }
+                    break;
+                }
+
+                int p = _nodes[found].event;
+                auto it = find(_seq.begin(), _seq.end(), p);
+                if (it != _seq.end()) _seq.erase(it);
+                _inBranch[p] = true;
+                _branch.push_back(p);
+                node = found;
+            }
+
+            for (int p : _branch) {
+                _inBranch[p] = false;
             }
         }
 
-        frontier.erase(choice);
-        outOrderMap[choice] = outOrder.size();
-        outOrder.push_back(choice);
-    }
-}
+        // Reverses every race of the complete order in _path
+        void AddRaces() {
+            int n = _path.size();
+            fill(_hb.begin(), _hb.end(), 0);
+            for (int j = 0; j < n; ++j) {
+                uint64_t * row = _hb.data() + (size_t)j * _words;
+                int v = _path[j];
+                auto addBefore = [&](int u) {
+                    int i = _pos[u];
+                    if (i >= j) return;
+                    const uint64_t * r = _hb.data() + (size_t)i * _words;
+                    for (int w = 0; w < _words; ++w) row[w] |= r[w];
+                    row[i / 64] |= 1ULL << (i % 64);
+                };
+                const CsrGraph & csr = _walk->GetGraph();
+                for (auto d = csr.DepBegin(v); d != csr.DepEnd(v); ++d) addBefore(*d);
+                for (int i = _predStart[v]; i < _predStart[v + 1]; ++i) addBefore(_pred[i]);
+            }
 
-void Pos::Basic(Graph * g, random_engine & random, map<Vertex *, int> & outOrderMap, vector<Vertex *> & outOrder) {
-    outOrderMap.clear();
-    outOrder.clear();
+            for (int j = 0; j < n; ++j) {
+                const uint64_t * row = _hb.data() + (size_t)j * _words;
+                fill(_covered.begin(), _covered.end(), 0);
+                for (int k = j - 1; k >= 0; --k) {
+                    if (!((row[k / 64] >> (k % 64)) & 1)) continue;
+                    const uint64_t * r = _hb.data() + (size_t)k * _words;
+                    bool direct = !((_covered[k / 64] >> (k % 64)) & 1);
+                    for (int w = 0; w < _words; ++w) _covered[w] |= r[w];
+                    if (direct && Test(_depRows, _path[k], _path[j]) && !IsPred(_path[k], _path[j])) {
+                        AddRace(k, j);
+                    }
+                }
+            }
+        }
 
-    map<Vertex *, double> priority;
-    uniform_real_distribution<double> dist(0.0, 1.0);
+        void AddRace(int k, int j) {
+            // all events after k that do not happen after it, then j
+            _seq.clear();
+            for (int m = k + 1; m < _path.size(); ++m) {
+                if (!((_hb[(size_t)m * _words + k / 64] >> (k % 64)) & 1)) {
+                    _seq.push_back(_path[m]);
+                }
+            }
+            _seq.push_back(_path[j]);
 
-    map<Vertex *, int> inDegree;
-    set<Vertex *> frontier;
+            for (int i = _stack[k].sleepBegin; i < SleepEnd(k); ++i) {
+                if (WeakInitial(k, _sleep[i])) return;
+            }
 
-    for (auto v : g->vertices) {
-        int d = 0;
-        for (auto e : v->inEdges) {
-            if (e->IsDirected()) {
-                ++d;
+            DBG(DBG_SCH, {
+                    cout << "race " << _path[k] << ' ' << _path[j] << " at " << k << ':';
+                    for (int x : _seq) cout << ' ' << x;
+                    cout << endl;
+                });
+            Insert(k);
+        }
+
+        void Emit(vector<Vertex *> & outOrder) const {
+            const CsrGraph & csr = _walk->GetGraph();
+            outOrder.resize(_path.size());
+            for (int i = 0; i < _path.size(); ++i) {
+                outOrder[i] = csr.vertices[_path[i]];
             }
         }
 
-        inDegree[v] = d;
-        if (d == 0) {
-            frontier.insert(v);
+        void PushFrame(int root, int sleepBegin) {
+            Frame f;
+            f.root = root;
+            f.sleepBegin = sleepBegin;
+            f.child = -1;
+            f.fresh = _nodes[root].first < 0;
+            _stack.push_back(f);
         }
-    }
 
-    while (frontier.size() > 0) {
-        Vertex * choice = nullptr;
-        double bestP;
+    public:
+        OptimalDporExplorer() : _blocked(0), _pendingLeaf(false) { }
 
-        for (auto v : frontier) {
-            double p;
-            if (priority.find(v) == priority.end()) {
-                p = priority[v] = dist(random);
+        void Begin(Graph * g) override {
+            _graph = g;
+            const CsrGraph & csr = g->Freeze();
+            int n = csr.Size();
+            _walk.reset(new TopoWalk(csr));
+
+            _words = (n + 63) / 64;
+            _depRows.assign((size_t)n * _words, 0);
+            _relRows.assign((size_t)n * _words, 0);
+            _predStart.assign(n + 1, 0);
+            for (int v = 0; v < n; ++v) {
+                for (auto d = csr.DepBegin(v); d != csr.DepEnd(v); ++d) {
+                    _depRows[(size_t)v * _words + *d / 64] |= 1ULL << (*d % 64);
+                    _relRows[(size_t)v * _words + *d / 64] |= 1ULL << (*d % 64);
+                }
+                for (auto s = csr.SuccBegin(v); s != csr.SuccEnd(v); ++s) {
+                    _relRows[(size_t)v * _words + *s / 64] |= 1ULL << (*s % 64);
+                    _relRows[(size_t)*s * _words + v / 64] |= 1ULL << (v % 64);
+                    ++_predStart[*s + 1];
+                }
             }
-            else {
-                p = priority[v];
+            for (int v = 0; v < n; ++v) {
+                _predStart[v + 1] += _predStart[v];
+            }
+            _pred.resize(_predStart[n]);
+            {
+                vector<int> next(_predStart.begin(), _predStart.end() - 1);
+                for (int v = 0; v < n; ++v) {
+                    for (auto s = csr.SuccBegin(v); s != csr.SuccEnd(v); ++s) {
+                        _pred[next[*s]++] = v;
+                    }
+                }
             }
 
-            if (choice == nullptr || bestP < p) {
-                choice = v;
-                bestP = p;
+            _hb.assign((size_t)n * _words, 0);
+            _covered.assign(_words, 0);
+            _pos.assign(n, n);
+            _inBranch.assign(n, false);
+            _stack.reserve(n + 1);
+            _path.reserve(n);
+            _blocked = 0;
+
+            _pendingLeaf = n == 0;
+            if (n > 0) {
+                PushFrame(NewNode(-1), 0);
             }
         }
 
-        for (auto e : choice->outEdges) {
-            if (e->IsDirected()) {
-                if (--inDegree[e->to] == 0) {
-                    frontier.insert(e->to);
+        bool Explore(vector<Vertex *> & outOrder) override {
+            int n = _walk->GetGraph().Size();
+
+            if (_pendingLeaf) {
+                _pendingLeaf = false;
+                Emit(outOrder);
+                return true;
+            }
+
+            while (_stack.size() > 0) {
+                Frame & f = _stack.back();
+
+                if (f.child >= 0) {
+                    // back from the subtree of the last child, which now
+                    // goes to sleep and leaves the wakeup tree
+                    int p = _nodes[f.child].event;
+                    assert(_nodes[f.child].first < 0);
+                    _walk->Unschedule(p);
+                    _path.pop_back();
+                    _pos[p] = n;
+                    _sleep.push_back(p);
+                    Node & root = _nodes[f.root];
+                    root.first = _nodes[f.child].next;
+                    if (root.first < 0) root.last = -1;
+                    _freeNodes.push_back(f.child);
+                    f.child = -1;
                 }
+
+                if (_nodes[f.root].first < 0) {
+                    int choice = -1;
+                    if (f.fresh) {
+                        // no wakeup sequence given, any awake event will do
+                        for (int v : _walk->Frontier()) {
+                            auto begin = _sleep.begin() + f.sleepBegin;
+                            if (find(begin, _sleep.end(), v) == _sleep.end()) {
+                                choice = v;
+                                break;
+                            }
+                        }
+                        if (choice < 0) ++_blocked;
+                        f.fresh = false;
+                    }
+
+                    if (choice < 0) {
+                        // the current level is exhausted
+                        _sleep.resize(f.sleepBegin);
+                        _stack.pop_back();
+                        continue;
+                    }
+                    AppendChild(f.root, choice);
+                }
+
+                f.child = _nodes[f.root].first;
+                int p = _nodes[f.child].event;
+                _walk->Schedule(p);
+                _pos[p] = _path.size();
+                _path.push_back(p);
+
+                if (_walk->Done()) {
+                    AddRaces();
+                    Emit(outOrder);
+                    return true;
+                }
+
+                // the child sleeps on what stays independent of p
+                int sleepBegin = _sleep.size();
+                for (int i = f.sleepBegin; i < sleepBegin; ++i) {
+                    int q = _sleep[i];
+                    if (!Test(_relRows, p, q)) _sleep.push_back(q);
+                }
+                PushFrame(f.child, sleepBegin);
             }
+
+            DBG(DBG_SCH, cout << "sleep-set blocked paths: " << _blocked << endl);
+            return false;
         }
 
-        frontier.erase(choice);
-        outOrderMap[choice] = outOrder.size();
-        outOrder.push_back(choice);
+        void End() override {
+            _graph = nullptr;
+            _walk.reset();
+            _nodes.clear();
+            _freeNodes.clear();
+            _stack.clear();
+            _sleep.clear();
+            _path.clear();
+        }
+
+        ~OptimalDporExplorer() override {
+        }
+    };
+
+    IExplorer * CreateOptimalDporExplorer() {
+        return new OptimalDporExplorer();
     }
-}
 
-void Pos::DependencyBased(Graph * g, random_engine & random, std::map<Vertex *, int> & outOrderMap, std::vector<Vertex *> & outOrder) {
-    outOrderMap.clear();
-    outOrder.clear();
+    vector<vector<Vertex *>> SplitDfs(Graph * g, int depth, bool sleepSet) {
+        vector<vector<Vertex *>> ret;
+        if (depth <= 0) {
+            ret.push_back({});
+            return ret;
+        }
 
-    map<Vertex *, double> priority;
-    uniform_real_distribution<double> dist(0.0, 1.0);
+        DfsExplorer e;
+        e.SetUseSleepSet(sleepSet);
+        e.SetMaxDepth(depth);
+        e.Begin(g);
+        vector<Vertex *> prefix;
+        while (e.Explore(prefix)) {
+            ret.push_back(prefix);
+        }
+        e.End();
+        return ret;
+    }
+
+    void RunOrdered(int tasks, int threads,
+                    const function<void(int)> & explore,
+                    const function<void(int)> & merge) {
+        if (threads <= 1) {
+            for (int t = 0; t < tasks; ++t) {
+                explore(t);
+                merge(t);
+            }
+            return;
+        }
 
-    map<Vertex *, int> inDegree;
-    set<Vertex *> frontier;
+        atomic<int> next(0);
+        mutex m;
+        condition_variable cv;
+        vector<bool> done(tasks, false);
+
+        vector<thread> pool;
+        for (int i = 0; i < threads; ++i) {
+            pool.emplace_back([&]() {
+                    for (int t = next++; t < tasks; t = next++) {
+                        explore(t);
+                        {
+                            lock_guard<mutex> lock(m);
+                            done[t] = true;
+                        }
+                        cv.notify_all();
+                    }
+                });
+        }
 
-    for (auto v : g->vertices) {
-        int d = 0;
-        for (auto e : v->inEdges) {
-            if (e->IsDirected()) {
-                ++d;
+        for (int t = 0; t < tasks; ++t) {
+            {
+                unique_lock<mutex> lock(m);
+                cv.wait(lock, [&]() { return done[t]; });
             }
+            merge(t);
         }
 
-        inDegree[v] = d;
-        if (d == 0) {
-            frontier.insert(v);
+        for (auto && th : pool) {
+            th.join();
         }
     }
+}
+
+PriorityFrontier::PriorityFrontier(int size)
+    : _pos(size, -1),
+      _key(size, 0) {
+    _heap.reserve(size);
+}
+
+void PriorityFrontier::SiftUp(int i) {
+    int v = _heap[i];
+    while (i > 0) {
+        int parent = (i - 1) / 2;
+        if (!Before(v, _heap[parent])) break;
+        _heap[i] = _heap[parent];
+        _pos[_heap[i]] = i;
+        i = parent;
+    }
+    _heap[i] = v;
+    _pos[v] = i;
+}
+
+void PriorityFrontier::SiftDown(int i) {
+    int v = _heap[i];
+    int n = _heap.size();
+    while (true) {
+        int child = 2 * i + 1;
+        if (child >= n) break;
+        if (child + 1 < n && Before(_heap[child + 1], _heap[child])) ++child;
+        if (!Before(_heap[child], v)) break;
+        _heap[i] = _heap[child];
+        _pos[_heap[i]] = i;
+        i = child;
+    }
+    _heap[i] = v;
+    _pos[v] = i;
+}
+
+void PriorityFrontier::Clear() {
+    for (auto v : _heap) {
+        _pos[v] = -1;
+    }
+    _heap.clear();
+}
+
+void PriorityFrontier::Push(int v, double key) {
+    assert(!Contains(v));
+    _key[v] = key;
+    _heap.push_back(v);
+    SiftUp(_heap.size() - 1);
+}
+
+int PriorityFrontier::PopMax() {
+    int top = _heap[0];
+    Remove(top);
+    return top;
+}
+
+void PriorityFrontier::Remove(int v) {
+    int i = _pos[v];
+    assert(i >= 0);
+    _pos[v] = -1;
+    int last = _heap.back();
+    _heap.pop_back();
+    if (last != v) {
+        _heap[i] = last;
+        _pos[last] = i;
+        SiftUp(i);
+        SiftDown(_pos[last]);
+    }
+}
+
+SamplerWorkspace::SamplerWorkspace(const CsrGraph & g)
+    : walk(g),
+      heap(g.Size()),
+      inactive(g.Size(), false) {
+    pending.reserve(g.Size());
+    schedulable.reserve(g.Size());
+    scheduled.reserve(g.Size());
+}
+
+typedef void (* Sampler)(random_engine &, SamplerWorkspace &, int *);
+
+// Runs a sampler on a fresh workspace and converts the result to the
+// pointer-based output of the original interface.
+static void SampleWithMap(Graph * g, random_engine & random, map<Vertex *, int> & outOrderMap, vector<Vertex *> & outOrder, Sampler sampler) {
+    const CsrGraph & csr = g->Freeze();
+    SamplerWorkspace ws(csr);
+    vector<int> order(csr.Size());
+
+    sampler(random, ws, order.data());
+
+    outOrderMap.clear();
+    outOrder.clear();
+    for (auto v : order) {
+        outOrderMap[csr.vertices[v]] = outOrder.size();
+        outOrder.push_back(csr.vertices[v]);
+    }
+}
+
+void RandomWalk::Basic(random_engine & random, SamplerWorkspace & ws, int * outOrder) {
+    uniform_real_distribution<double> dist(0.0, 1.0);
+
+    TopoWalk & walk = ws.walk;
+    walk.Reset();
+    auto & frontier = walk.Frontier();
 
     while (frontier.size() > 0) {
-        Vertex * choice = nullptr;
+        int choice = -1;
         double bestP;
 
         for (auto v : frontier) {
-            double p;
-            if (priority.find(v) == priority.end()) {
-                p = priority[v] = dist(random);
-            }
-            else {
-                p = priority[v];
-            }
+            double p = dist(random);
 
-            if (choice == nullptr || bestP < p) {
+            if (choice < 0 || bestP < p) {
                 choice = v;
                 bestP = p;
             }
         }
 
-        for (auto e : choice->outEdges) {
-            if (e->IsDirected()) {
-                if (--inDegree[e->to] == 0) {
-                    frontier.insert(e->to);
-                }
-            }
-            else {
-                priority.erase(e->to);
-            }
-        }
-
-        frontier.erase(choice);
-        outOrderMap[choice] = outOrder.size();
-        outOrder.push_back(choice);
+        walk.Schedule(choice);
+        *outOrder++ = choice;
     }
 }
 
-void Misc::Rapos(Graph * g, random_engine & random, map<Vertex *, int> & outOrderMap, vector<Vertex *> & outOrder) {
-    outOrderMap.clear();
-    outOrder.clear();
+void RandomWalk::Basic(Graph * g, random_engine & random, map<Vertex *, int> & outOrderMap, vector<Vertex *> & outOrder) {
+    SampleWithMap(g, random, outOrderMap, outOrder, RandomWalk::Basic);
+}
 
+// Shared by both POS variants. Priorities are drawn for newly enabled (or
+// reset) vertices in id order, which keeps the random stream identical to a
+// linear scan of the id-sorted frontier.
+static void PosSample(random_engine & random, SamplerWorkspace & ws, int * outOrder, bool resetDependent) {
     uniform_real_distribution<double> dist(0.0, 1.0);
-    map<Vertex *, int> inDegree;
-    set<Vertex *> frontier;
+    const CsrGraph & g = ws.walk.GetGraph();
 
-    for (auto v : g->vertices) {
-        int d = 0;
-        for (auto e : v->inEdges) {
-            if (e->IsDirected()) {
-                ++d;
-            }
-        }
+    auto & heap = ws.heap;
+    auto & pending = ws.pending;
+    heap.Clear();
+
+    TopoWalk & walk = ws.walk;
+    walk.Reset(false);
+    pending.assign(walk.Frontier().begin(), walk.Frontier().end());
 
-        inDegree[v] = d;
-        if (d == 0) {
-            frontier.insert(v);
+    while (!walk.Done()) {
+        sort(pending.begin(), pending.end());
+        for (auto v : pending) {
+            heap.Push(v, dist(random));
         }
-    }
+        pending.clear();
 
-    map<Vertex *, set<Vertex *>> dep;
+        int choice = heap.PopMax();
 
-    for (auto e : g->edges) {
-        if (!e->IsDirected()) {
-            dep[e->from].insert(e->to);
+        if (resetDependent) {
+            for (auto d = g.DepBegin(choice); d != g.DepEnd(choice); ++d) {
+                if (heap.Contains(*d)) {
+                    heap.Remove(*d);
+                    pending.push_back(*d);
+                }
+            }
         }
+
+        walk.Schedule(choice);
+        pending.insert(pending.end(), walk.Enabled().begin(), walk.Enabled().end());
+        *outOrder++ = choice;
     }
+}
+
+void Pos::Basic(random_engine & random, SamplerWorkspace & ws, int * outOrder) {
+    PosSample(random, ws, outOrder, false);
+}
+
+void Pos::Basic(Graph * g, random_engine & random, map<Vertex *, int> & outOrderMap, vector<Vertex *> & outOrder) {
+    SampleWithMap(g, random, outOrderMap, outOrder, Pos::Basic);
+}
 
-    vector<Vertex *> schedulable(frontier.begin(), frontier.end());
+void Pos::DependencyBased(random_engine & random, SamplerWorkspace & ws, int * outOrder) {
+    PosSample(random, ws, outOrder, true);
+}
+
+void Pos::DependencyBased(Graph * g, random_engine & random, map<Vertex *, int> & outOrderMap, vector<Vertex *> & outOrder) {
+    SampleWithMap(g, random, outOrderMap, outOrder, Pos::DependencyBased);
+}
+
+void Misc::Rapos(random_engine & random, SamplerWorkspace & ws, int * outOrder) {
+    uniform_real_distribution<double> dist(0.0, 1.0);
+    const CsrGraph & g = ws.walk.GetGraph();
+
+    TopoWalk & walk = ws.walk;
+    walk.Reset();
+    auto & frontier = walk.Frontier();
+    auto & inactive = ws.inactive;
+    auto & schedulable = ws.schedulable;
+    auto & scheduled = ws.scheduled;
+
+    schedulable.assign(frontier.begin(), frontier.end());
 
     while (frontier.size() > 0) {
         assert(schedulable.size() > 0);
 
-        vector<Vertex *> scheduled;
+        scheduled.clear();
         {
             uniform_int_distribution<int> dist(0, schedulable.size() - 1);
             scheduled.push_back(schedulable[dist(random)]);
         }
 
         for (int i = 0; i < schedulable.size(); ++i) {
-            assert(frontier.find(schedulable[i]) != end(frontier));
+            assert(walk.InFrontier(schedulable[i]));
 
             bool isIndependent = true;
             for (auto v : scheduled) {
                 if (v == schedulable[i] ||
-                    (dep.find(v) != end(dep) && dep[v].find(schedulable[i]) != end(dep[v]))) {
+                    find(g.DepBegin(v), g.DepEnd(v), schedulable[i]) != g.DepEnd(v)) {
                     isIndependent = false;
                     break;
                 }
@@ -419,52 +951,42 @@ void Misc::Rapos(Graph * g, random_engine & random, map<Vertex *, int> & outOrde
             }
         }
 
-        set<Vertex *> inactive = frontier;
+        // vertices of the current frontier stay inactive unless a scheduled
+        // vertex conflicts with them; scheduling clears every flag it set
+        for (auto v : frontier) {
+            inactive[v] = true;
+        }
 
         for (int i = 0; i < scheduled.size(); ++i) {
-            Vertex * choice = scheduled[i];
-            assert(frontier.find(choice) != end(frontier));
+            int choice = scheduled[i];
+            assert(walk.InFrontier(choice));
 
-            for (auto e : choice->outEdges) {
-                if (e->IsDirected()) {
-                    if (--inDegree[e->to] == 0) {
-                        frontier.insert(e->to);
-                    }
-                }
-                else {
-                    if (inactive.find(e->to) != end(inactive)) {
-                        inactive.erase(e->to);
-                    }
-                }
+            for (auto d = g.DepBegin(choice); d != g.DepEnd(choice); ++d) {
+                inactive[*d] = false;
             }
 
-            inactive.erase(choice);
-            frontier.erase(choice);
-            outOrderMap[choice] = outOrder.size();
-            outOrder.push_back(choice);
+            inactive[choice] = false;
+            walk.Schedule(choice);
+            *outOrder++ = choice;
         }
 
         schedulable.clear();
         if (frontier.size() > 0) {
             uniform_int_distribution<int> dist(0, frontier.size() - 1);
-            Vertex * backup = nullptr;
-            int backupIndex = dist(random);
-            int index = 0;
+            int backup = frontier[dist(random)];
             for (auto v : frontier) {
-                if (index == backupIndex) {
-                    backup = v;
-                }
-                ++index;
-
-                if (inactive.find(v) == end(inactive)) {
+                if (!inactive[v]) {
                     schedulable.push_back(v);
                 }
             }
 
             if (schedulable.size() == 0) {
-                assert(backup != nullptr);
                 schedulable.push_back(backup);
             }
         }
     }
 }
+
+void Misc::Rapos(Graph * g, random_engine & random, map<Vertex *, int> & outOrderMap, vector<Vertex *> & outOrder) {
+    SampleWithMap(g, random, outOrderMap, outOrder, Misc::Rapos);
+}
@@ -2,6 +2,8 @@
 #define __SCHEDULERS_HPP__
 
 #include "Base.hpp"
+#include <cstdint>
+#include <functional>
 
 namespace Systematic {
     class IExplorer {
@@ -13,18 +15,86 @@ namespace Systematic {
     };
 
     IExplorer * CreateDfsExplorer(bool sleepSet = true);
+    // Tries the children of every node in a random order drawn from seed
+    // instead of id order. The enumeration is still complete and, for a given
+    // seed, deterministic; its prefixes suit anytime partial enumeration.
+    IExplorer * CreateRandomizedDfsExplorer(uint64_t seed, bool sleepSet = true);
+
+    // Splitting the enumeration for parallel runs. SplitDfs returns the paths
+    // of the DFS tree cut at `depth` (shorter only if the graph is), in DFS
+    // order. The explorer for one prefix yields exactly the orders of the
+    // full enumeration that start with it, in the same sequence, so
+    // concatenating the prefixes' orders reproduces the full enumeration.
+    std::vector<std::vector<Vertex *>> SplitDfs(Graph * g, int depth, bool sleepSet = true);
+    IExplorer * CreateDfsExplorer(const std::vector<Vertex *> & prefix, bool sleepSet = true);
+
+    // Optimal DPOR: visits exactly one order per trace and never ends in a
+    // sleep-set blocked path, so it does less work than the sleep-set DFS.
+    // The orders come in a different sequence and cannot be split.
+    IExplorer * CreateOptimalDporExplorer();
+
+    // Runs explore(t) for t in [0, tasks) on `threads` threads and hands each
+    // finished task to merge(t) on the calling thread in increasing t
+    void RunOrdered(int tasks, int threads,
+                    const std::function<void(int)> & explore,
+                    const std::function<void(int)> & merge);
 }
 
+// Indexed binary max-heap of vertex ids keyed by priority, ties going to the
+// smaller id. Members can be removed from anywhere in the heap.
+class PriorityFrontier {
+    std::vector<int> _heap;
+    std::vector<int> _pos; // index in _heap, -1 if absent
+    std::vector<double> _key;
+
+    inline bool Before(int a, int b) const {
+        return _key[a] > _key[b] || (_key[a] == _key[b] && a < b);
+    }
+    void SiftUp(int i);
+    void SiftDown(int i);
+
+public:
+    explicit PriorityFrontier(int size);
+
+    inline bool Empty() const { return _heap.empty(); }
+    inline bool Contains(int v) const { return _pos[v] >= 0; }
+    void Clear();
+    void Push(int v, double key);
+    int PopMax();
+    void Remove(int v);
+};
+
+// Scratch space reused by the samplers across traces. All arrays are indexed
+// by vertex id and sized up front, so sampling performs no heap allocation.
+struct SamplerWorkspace {
+    TopoWalk walk;
+    PriorityFrontier heap;
+    std::vector<int> pending; // enabled vertices waiting for a priority
+    std::vector<bool> inactive;
+    std::vector<int> schedulable;
+    std::vector<int> scheduled;
+
+    explicit SamplerWorkspace(const CsrGraph & g);
+};
+
+// Each sampler writes one trace of the graph of ws.walk, as its Size() vertex
+// ids, to outOrder. The Graph * overloads are the original interface, kept as
+// thin wrappers.
+
 namespace RandomWalk {
+    void Basic(random_engine & random, SamplerWorkspace & ws, int * outOrder);
     void Basic(Graph * g, random_engine & random, std::map<Vertex *, int> & outOrderMap, std::vector<Vertex *> & outOrder);
 }
 
 namespace Pos {
+    void Basic(random_engine & random, SamplerWorkspace & ws, int * outOrder);
     void Basic(Graph * g, random_engine & random, std::map<Vertex *, int> & outOrderMap, std::vector<Vertex *> & outOrder);
+    void DependencyBased(random_engine & random, SamplerWorkspace & ws, int * outOrder);
     void DependencyBased(Graph * g, random_engine & random, std::map<Vertex *, int> & outOrderMap, std::vector<Vertex *> & outOrder);
 }
 
 namespace Misc {
+    void Rapos(random_engine & random, SamplerWorkspace & ws, int * outOrder);
     void Rapos(Graph * g, random_engine & random, std::map<Vertex *, int> & outOrderMap, std::vector<Vertex *> & outOrder);
 }
 
@@ -0,0 +1,145 @@
+#include "Base.hpp"
+#include "Schedulers.hpp"
+#include "PorStat.hpp"
+#include "CaseIO.hpp"
+#include <cassert>
+#include <chrono>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <regex>
+#include <vector>
+#include <map>
+
+using namespace std;
+
+// Compares trace classifiers on a case file read from stdin (the format taken
+// by Calc). The workload is the first `max-orders` orders of the exhaustive
+// enumeration followed by `samples` POS samples, generated up front so that
+// only classification is timed. With `dfs-seed` the enumeration tries
+// children in a seeded random order, so a partial one is less lopsided.
+int main(int argc, char ** argv) {
+    Graph * g = new Graph();
+    map<string, string> opts;
+
+    {
+        regex reKv("([-_a-zA-Z.0-9]+)=(.*)");
+        for (int i = 1; i < argc; ++i) {
+            smatch m;
+            string arg(argv[i]);
+            if (regex_match(arg, m, reKv) && arg[0] != '-') {
+                opts[m[1]] = m[2];
+            }
+        }
+    }
+
+    long maxOrders = 1000000;
+    long samples = 100000;
+    long seed = 0;
+    bool randomDfs = false;
+    uint64_t dfsSeed = 0;
+    vector<string> classifiers = { "portree", "foata" };
+
+    if (opts.find("max-orders") != opts.end()) {
+        maxOrders = stol(opts["max-orders"]);
+    }
+
+    if (opts.find("samples") != opts.end()) {
+        samples = stol(opts["samples"]);
+    }
+
+    if (opts.find("seed") != opts.end()) {
+        seed = stol(opts["seed"]);
+    }
+
+    if (opts.find("dfs-seed") != opts.end()) {
+        randomDfs = true;
+        dfsSeed = stoull(opts["dfs-seed"]);
+    }
+
+    if (opts.find("classifier") != opts.end()) {
+        classifiers.clear();
+        stringstream ss(opts["classifier"]);
+        string name;
+        while (getline(ss, name, ',')) {
+            classifiers.push_back(name);
+        }
+    }
+
+    Case input;
+    if (!CaseIO::Read(0, input)) {
+        cerr << "Cannot read the case" << endl;
+        return 1;
+    }
+    // read-read dependencies are only used by RPOS sampling
+    Graph rrGraph;
+    input.Build(g, &rrGraph);
+
+    const CsrGraph & csr = g->Freeze();
+    int n = csr.Size();
+
+    // all orders back to back, n vertices each
+    vector<Vertex *> workload;
+    {
+        auto e = randomDfs
+            ? Systematic::CreateRandomizedDfsExplorer(dfsSeed, false)
+            : Systematic::CreateDfsExplorer(false);
+        e->Begin(g);
+        vector<Vertex *> order;
+        for (long i = 0; i < maxOrders && e->Explore(order); ++i) {
+            workload.insert(workload.end(), order.begin(), order.end());
+        }
+        e->End();
+        delete e;
+
+        SamplerWorkspace ws(csr);
+        vector<int> ids(n);
+        random_engine re(seed);
+        for (long i = 0; i < samples; ++i) {
+            random_engine algoRe(re());
+            Pos::DependencyBased(algoRe, ws, ids.data());
+            for (auto v : ids) {
+                workload.push_back(csr.vertices[v]);
+            }
+        }
+    }
+    long orderCount = n > 0 ? workload.size() / n : 0;
+
+    cout << "classifier,orders,classes,seconds,orders per second,peak bytes" << endl;
+
+    vector<int> reference;
+    for (auto && name : classifiers) {
+        unique_ptr<Trace::IClassifier> c(Trace::CreateClassifier(name, g));
+        if (!c) {
+            cerr << "Unknown classifier " << name << endl;
+            return 1;
+        }
+
+        vector<int> classes(orderCount);
+        vector<Vertex *> order(n);
+        auto start = chrono::steady_clock::now();
+        for (long i = 0; i < orderCount; ++i) {
+            copy(workload.begin() + i * n, workload.begin() + (i + 1) * n, order.begin());
+            bool isNew;
+            classes[i] = c->Classify(order, isNew);
+        }
+        double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+        cout << name << ',' << orderCount << ',' << c->ClassCount() << ','
+             << seconds << ',' << (seconds > 0 ? orderCount / seconds : 0) << ','
+             << c->PeakBytes() << endl;
+
+        // classes are numbered in discovery order, so all backends must agree
+        if (reference.empty()) {
+            reference.swap(classes);
+        }
+        else if (classes != reference) {
+            cerr << name << " disagrees with " << classifiers[0] << endl;
+            return 1;
+        }
+    }
+
+    delete g;
+    return 0;
+}
@@ -0,0 +1,109 @@
+#include "TraceStore.hpp"
+#include <algorithm>
+#include <cassert>
+#include <cstdlib>
+#include <iostream>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+using namespace std;
+
+// at most 5 bytes per 32-bit id
+#define VARINT_MAX_BYTES 5
+
+static inline void PutVarint(uint8_t *& p, uint32_t id) {
+    while (id >= 0x80) {
+        *p++ = (uint8_t)(id | 0x80);
+        id >>= 7;
+    }
+    *p++ = (uint8_t)id;
+}
+
+TraceStore::TraceStore()
+    : _fd(-1), _map(nullptr), _mapped(0), _size(0), _offsets(1, 0) { }
+
+TraceStore::~TraceStore() {
+    if (_fd >= 0) {
+        munmap(_map, _mapped);
+        // drop the unused tail of the last growth
+        int r = ftruncate(_fd, _size);
+        (void)r;
+        close(_fd);
+    }
+}
+
+bool TraceStore::Open(const string & path) {
+    assert(Size() == 0);
+    int fd = open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) return false;
+    _fd = fd;
+    _heap.clear();
+    _heap.shrink_to_fit();
+    return true;
+}
+
+uint8_t * TraceStore::Reserve(size_t bytes) {
+    if (_fd < 0) {
+        if (_heap.size() < _size + bytes) {
+            _heap.resize(max(_heap.size() * 2, _size + bytes));
+        }
+        return _heap.data() + _size;
+    }
+
+    if (_mapped < _size + bytes) {
+        size_t mapped = max(max(_mapped * 2, _size + bytes), (size_t)1 << 20);
+        if (_map != nullptr) munmap(_map, _mapped);
+        void * p = MAP_FAILED;
+        if (ftruncate(_fd, mapped) == 0) {
+            p = mmap(nullptr, mapped, PROT_READ | PROT_WRITE, MAP_SHARED, _fd, 0);
+        }
+        if (p == MAP_FAILED) {
+            cerr << "Cannot grow the trace store to " << mapped << " bytes" << endl;
+            abort();
+        }
+        _map = (uint8_t *)p;
+        _mapped = mapped;
+    }
+    return _map + _size;
+}
+
+size_t TraceStore::Append(const vector<Vertex *> & order) {
+    uint8_t * p = Reserve(order.size() * VARINT_MAX_BYTES);
+    uint8_t * begin = p;
+    for (auto v : order) {
+        PutVarint(p, v->id);
+    }
+    _size += p - begin;
+    _offsets.push_back(_size);
+    return Size() - 1;
+}
+
+size_t TraceStore::Append(const vector<int> & ids) {
+    uint8_t * p = Reserve(ids.size() * VARINT_MAX_BYTES);
+    uint8_t * begin = p;
+    for (int v : ids) {
+        PutVarint(p, v);
+    }
+    _size += p - begin;
+    _offsets.push_back(_size);
+    return Size() - 1;
+}
+
+void TraceStore::Get(size_t i, vector<int> & outIds) const {
+    assert(i < Size());
+    const uint8_t * data = _fd < 0 ? _heap.data() : _map;
+    const uint8_t * p = data + _offsets[i];
+    const uint8_t * end = data + _offsets[i + 1];
+    outIds.clear();
+    while (p < end) {
+        uint32_t id = 0;
+        int shift = 0;
+        while (*p & 0x80) {
+            id |= (uint32_t)(*p++ & 0x7f) << shift;
+            shift += 7;
+        }
+        id |= (uint32_t)*p++ << shift;
+        outIds.push_back(id);
+    }
+}
@@ -0,0 +1,42 @@
+#ifndef __TRACE_STORE_HPP__
+#define __TRACE_STORE_HPP__
+
+#include "Base.hpp"
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Append-only store of orders, each packed as LEB128 varint vertex ids and
+// found through an in-memory offset index. The bytes live on the heap, or
+// in a memory-mapped file once Open() succeeds, so that large runs keep the
+// orders out of RAM and stream them back when reading.
+class TraceStore {
+    std::vector<uint8_t> _heap;
+    int _fd;          // -1 while on the heap
+    uint8_t * _map;
+    size_t _mapped;   // bytes mapped, also the file size
+    size_t _size;     // bytes used
+    std::vector<uint64_t> _offsets; // start of order i; Size() + 1 entries
+
+    uint8_t * Reserve(size_t bytes);
+
+public:
+    TraceStore();
+    TraceStore(const TraceStore &) = delete;
+    TraceStore & operator=(const TraceStore &) = delete;
+    ~TraceStore();
+
+    // Moves the store to a new file at path, truncating it. Must be called
+    // while the store is empty; returns false if the file cannot be created.
+    bool Open(const std::string & path);
+
+    // Returns the index of the appended order
+    size_t Append(const std::vector<Vertex *> & order);
+    size_t Append(const std::vector<int> & ids);
+    void Get(size_t i, std::vector<int> & outIds) const;
+
+    inline size_t Size() const { return _offsets.size() - 1; }
+    inline size_t Bytes() const { return _size + _offsets.capacity() * sizeof(uint64_t); }
+};
+
+#endif
@@ -2,22 +2,52 @@
 #include "Generators.hpp"
 #include <iostream>
 #include <algorithm>
+#include <map>
+#include <regex>
+#include <string>
 
 using namespace std;
 using namespace Generator;
 
-int main() {
+// Random walks on a uniform random tree of `vertices` vertices (100 by
+// default), printing how often each vertex ends a walk
+int main(int argc, char ** argv) {
     Graph * g = new Graph();
+    map<string, string> opts;
+
+    {
+        regex reKv("([-_a-zA-Z.0-9]+)=(.*)");
+        for (int i = 1; i < argc; ++i) {
+            smatch m;
+            string arg(argv[i]);
+            if (regex_match(arg, m, reKv) && arg[0] != '-') {
+                opts[m[1]] = m[2];
+            }
+        }
+    }
+
+    int vertices = 100;
+    if (opts.find("vertices") != opts.end()) {
+        vertices = stoi(opts["vertices"]);
+    }
+    int walks = 1000000;
+    if (opts.find("walks") != opts.end()) {
+        walks = stoi(opts["walks"]);
+    }
+
     random_device rd;
     random_engine random(rd());
+    if (opts.find("seed") != opts.end()) {
+        random.seed(stoll(opts["seed"]));
+    }
 
-    AntiChain(g, 100);
+    AntiChain(g, vertices);
     RandomTree(g, random);
 
     map<Vertex *, int> count;
     Vertex * now = g->vertices[0];
     Vertex * prev = nullptr;
-    for (int i = 0; i < 1000000; ++i) {
+    for (int i = 0; i < walks; ++i) {
         vector<tuple<Vertex *, Vertex *>> path;
         while (true) {
             path.push_back(make_tuple(prev, now));
@@ -9,6 +9,8 @@ parser = argparse.ArgumentParser()
 parser.add_argument("-j", type = int, dest = "nproc", default = 1)
 parser.add_argument("-i", type = str, dest = "input")
 parser.add_argument("-s", type = int, dest = "n_sample", default = 50000000)
+parser.add_argument("-t", type = int, dest = "n_thread", default = 1)
+parser.add_argument("-c", type = str, dest = "classifier", default = "portree")
 parser.add_argument("--no-sample", dest = "no_sample", action = "store_true")
 args = parser.parse_args()
 
@@ -51,7 +53,7 @@ for line in input:
     job_input = open(case_name)
     job_output = open(case_name + ".result", "w")
     # cmd = [ os.path.join(local_dir, "build", "Calc") ]
-    cmd = [ "build/Calc" ]
+    cmd = [ "build/Calc", "threads={0}".format(args.n_thread), "classifier={0}".format(args.classifier) ]
     p = subprocess.Popen(cmd, env = env, stdin = job_input, stdout = job_output)
     # cmd = [ "/bin/ls" ]
     # p = subprocess.Popen(cmd, env = env)